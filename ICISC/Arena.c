@@ -0,0 +1,317 @@
+#include "header.h"
+
+/*
+*   Compact state arena
+*
+*   An idle instance is its st_compact record only. The first generate on it
+*   expands its key into the least recently used cache entry; while the
+*   instance stays cached, the update at the end of each request expands the
+*   new key into the same entry, so a hot instance never misses.
+*   Free records form a list through reseed_counter, linked by index + 1.
+*   The low 23 bits of the fork generation a record was seeded in sit in
+*   its flags; a record generated from in a forked child is reseeded first.
+*   Records and cache are secure memory, a large arena on huge pages.
+*/
+#define ARENA_FREE 0x80000000u
+#define ARENA_GEN_SHIFT 8
+#define ARENA_GEN_MASK 0x7fffff00u
+#define ARENA_GEN(gen) ((unsigned int)((gen) << ARENA_GEN_SHIFT) & ARENA_GEN_MASK)
+#define KEY_NONE 0xffffffffu
+
+typedef struct _KEY_ENTRY {
+    u8 round_key[ROUND_KEY_LEN];
+    int R;
+    unsigned int owner; // arena index + 1, 0 when unused
+    unsigned int prev, next; // toward the MRU / LRU end
+} st_key_entry;
+
+struct _ARENA {
+    st_compact *state;
+    size_t count, capacity;
+    unsigned long long free_list; // index + 1, 0 when empty
+    st_key_entry *cache;
+    unsigned int entries, mru, lru;
+    unsigned long long hits, misses;
+};
+
+//! cache_entries 0 takes KEY_CACHE_ENTRIES
+st_arena *Arena_New(size_t capacity, unsigned int cache_entries)
+{
+    st_arena *arena;
+
+    if (capacity > (size_t)-1 / sizeof(st_compact))
+        return NULL;
+    arena = (st_arena *)calloc(1, sizeof(st_arena));
+    if (arena == NULL)
+        return NULL;
+    if (cache_entries == 0)
+        cache_entries = KEY_CACHE_ENTRIES;
+    arena->state = (st_compact *)Secure_Alloc(capacity * sizeof(st_compact), SECURE_HUGE);
+    arena->cache = (st_key_entry *)Secure_Alloc(cache_entries * sizeof(st_key_entry), SECURE_HUGE);
+    if (arena->state == NULL || arena->cache == NULL)
+    {
+        Arena_Free(arena);
+        return NULL;
+    }
+    arena->capacity = capacity;
+    arena->entries = cache_entries;
+
+    //! entry 0 is the MRU end, entry cache_entries - 1 the LRU end
+    for (unsigned int cnt_i = 0; cnt_i < cache_entries; cnt_i++)
+    {
+        arena->cache[cnt_i].prev = cnt_i == 0 ? KEY_NONE : cnt_i - 1;
+        arena->cache[cnt_i].next = cnt_i + 1 == cache_entries ? KEY_NONE : cnt_i + 1;
+    }
+    arena->mru = 0;
+    arena->lru = cache_entries - 1;
+    return arena;
+}
+
+static void cache_unlink(st_arena *arena, unsigned int e)
+{
+    st_key_entry *entry = &arena->cache[e];
+
+    if (entry->prev != KEY_NONE)
+        arena->cache[entry->prev].next = entry->next;
+    else
+        arena->mru = entry->next;
+    if (entry->next != KEY_NONE)
+        arena->cache[entry->next].prev = entry->prev;
+    else
+        arena->lru = entry->prev;
+}
+
+static void cache_push(st_arena *arena, unsigned int e, int mru)
+{
+    st_key_entry *entry = &arena->cache[e];
+
+    if (mru)
+    {
+        entry->prev = KEY_NONE;
+        entry->next = arena->mru;
+        if (arena->mru != KEY_NONE)
+            arena->cache[arena->mru].prev = e;
+        arena->mru = e;
+        if (arena->lru == KEY_NONE)
+            arena->lru = e;
+    }
+    else
+    {
+        entry->next = KEY_NONE;
+        entry->prev = arena->lru;
+        if (arena->lru != KEY_NONE)
+            arena->cache[arena->lru].next = e;
+        arena->lru = e;
+        if (arena->mru == KEY_NONE)
+            arena->mru = e;
+    }
+}
+
+//! drop st's schedule and hand its entry to the next miss
+static void cache_drop(st_arena *arena, st_compact *st)
+{
+    unsigned int e;
+
+    if (st->cache == 0)
+        return;
+    e = st->cache - 1;
+    clear(arena->cache[e].round_key, ROUND_KEY_LEN);
+    arena->cache[e].owner = 0;
+    cache_unlink(arena, e);
+    cache_push(arena, e, FALSE);
+    st->cache = 0;
+}
+
+static st_key_entry *cache_get(st_arena *arena, size_t id)
+{
+    st_compact *st = &arena->state[id];
+    unsigned int e;
+
+    if (st->cache != 0)
+    {
+        e = st->cache - 1;
+        arena->hits++;
+    }
+    else
+    {
+        e = arena->lru;
+        if (arena->cache[e].owner != 0)
+            arena->state[arena->cache[e].owner - 1].cache = 0;
+        arena->cache[e].owner = (unsigned int)id + 1;
+        arena->cache[e].R = Kernel()->key_setup(st->key, arena->cache[e].round_key, KEY_BIT);
+        st->cache = e + 1;
+        arena->misses++;
+    }
+    if (arena->mru != e)
+    {
+        cache_unlink(arena, e);
+        cache_push(arena, e, TRUE);
+    }
+    return &arena->cache[e];
+}
+
+static void arena_unpack(const st_compact *st, st_state *state)
+{
+    memcpy(state->key, st->key, KEY_SIZE);
+    memcpy(state->V, st->V, BLOCK_SIZE);
+    state->Reseed_counter = st->reseed_counter;
+    state->Reseed_bytes = st->reseed_bytes;
+    state->prediction_flag = (st->flags & ARENA_PREDICTION) ? TRUE : FALSE;
+    state->fork_gen = Fork_Generation();
+}
+
+//! back from a reseeded state, whose new key the cache does not hold
+static void arena_pack(st_arena *arena, st_compact *st, const st_state *state)
+{
+    memcpy(st->key, state->key, KEY_SIZE);
+    memcpy(st->V, state->V, BLOCK_SIZE);
+    st->reseed_counter = state->Reseed_counter;
+    st->reseed_bytes = state->Reseed_bytes;
+    cache_drop(arena, st);
+}
+
+long Arena_Instantiate(st_arena *arena, u8 *in, unsigned int flags)
+{
+    st_state state;
+    size_t id;
+
+    if (arena->free_list != 0)
+    {
+        id = (size_t)(arena->free_list - 1);
+        arena->free_list = arena->state[id].reseed_counter;
+    }
+    else if (arena->count < arena->capacity)
+    {
+        id = arena->count++;
+    }
+    else
+    {
+        return -1;
+    }
+
+    Instantiate(&state, in);
+    memcpy(arena->state[id].key, state.key, KEY_SIZE);
+    memcpy(arena->state[id].V, state.V, BLOCK_SIZE);
+    arena->state[id].reseed_counter = 0;
+    arena->state[id].reseed_bytes = 0;
+    arena->state[id].flags = (flags & ARENA_PREDICTION) | ARENA_GEN(Fork_Generation());
+    arena->state[id].cache = 0;
+    clear((u8 *)&state, sizeof(st_state));
+    return (long)id;
+}
+
+//! generate_request on a compact record, the schedule comes from the cache
+static void arena_request(st_compact *st, st_key_entry *entry, u8 *random, size_t len)
+{
+    const st_kernel *kernel = Kernel();
+    u8 last[BLOCK_SIZE] = {0x00};
+    u8 seed[SEED_LEN] = {0x00};
+    u8 temp[SEED_LEN] = {0x00};
+    size_t blocks = len / BLOCK_SIZE;
+
+    kernel->ctr(entry->round_key, entry->R, st->V, random, blocks);
+    if (len % BLOCK_SIZE != 0)
+    {
+        kernel->ctr(entry->round_key, entry->R, st->V, last, 1);
+        memcpy(random + blocks * BLOCK_SIZE, last, len % BLOCK_SIZE);
+        clear(last, BLOCK_SIZE);
+    }
+
+    memcpy(seed, st->key, KEY_SIZE);
+    memcpy(seed + KEY_SIZE, st->V, BLOCK_SIZE);
+    kernel->ctr(entry->round_key, entry->R, st->V, temp, LEN_SEED);
+    for (int cnt_i = 0; cnt_i < KEY_SIZE; cnt_i++)
+    {
+        st->key[cnt_i] = temp[cnt_i] ^ seed[cnt_i];
+    }
+    for (int cnt_i = 0; cnt_i < BLOCK_SIZE; cnt_i++)
+    {
+        st->V[cnt_i] = temp[KEY_SIZE + cnt_i] ^ seed[KEY_SIZE + cnt_i];
+    }
+    entry->R = kernel->key_setup(st->key, entry->round_key, KEY_BIT);
+    clear(seed, SEED_LEN);
+    clear(temp, SEED_LEN);
+}
+
+//! generate_Bytes on instance id
+int Arena_Generate(st_arena *arena, long id, u8 *random, size_t len, u8 *re_add_data)
+{
+    st_compact *st;
+
+    if (id < 0 || (size_t)id >= arena->count || (arena->state[id].flags & ARENA_FREE))
+        return FALSE;
+    st = &arena->state[id];
+
+    if ((st->flags & ARENA_GEN_MASK) != ARENA_GEN(Fork_Generation()))
+    {
+        st_state state;
+        int ok;
+
+        arena_unpack(st, &state);
+        ok = Fork_Reseed(&state);
+        if (ok)
+        {
+            arena_pack(arena, st, &state);
+            st->flags = (st->flags & ~ARENA_GEN_MASK) | ARENA_GEN(state.fork_gen);
+        }
+        clear((u8 *)&state, sizeof(st_state));
+        if (!ok)
+            return FALSE;
+    }
+    do
+    {
+        size_t n = len < MAX_REQUEST_LEN ? len : MAX_REQUEST_LEN;
+
+        if ((st->flags & ARENA_PREDICTION) || Reseed_Due(st->reseed_counter, st->reseed_bytes, n))
+        {
+            st_state state;
+            int ok;
+
+            arena_unpack(st, &state);
+            ok = Reseed_Check(&state, n) &&
+                 (!state.prediction_flag || Reseed_Prediction(&state, re_add_data));
+            if (ok)
+                arena_pack(arena, st, &state);
+            clear((u8 *)&state, sizeof(st_state));
+            if (!ok)
+                return FALSE;
+        }
+        arena_request(st, cache_get(arena, (size_t)id), random, n);
+        st->reseed_counter++;
+        st->reseed_bytes += n;
+        re_add_data = NULL;
+        random += n;
+        len -= n;
+    } while (len > 0);
+    return TRUE;
+}
+
+//! zeroize instance id and put its record on the free list
+void Arena_Remove(st_arena *arena, long id)
+{
+    st_compact *st;
+
+    if (id < 0 || (size_t)id >= arena->count || (arena->state[id].flags & ARENA_FREE))
+        return;
+    st = &arena->state[id];
+    cache_drop(arena, st);
+    clear((u8 *)st, sizeof(st_compact));
+    st->flags = ARENA_FREE;
+    st->reseed_counter = arena->free_list;
+    arena->free_list = (unsigned long long)id + 1;
+}
+
+void Arena_Stats(const st_arena *arena, unsigned long long *hits, unsigned long long *misses)
+{
+    *hits = arena->hits;
+    *misses = arena->misses;
+}
+
+void Arena_Free(st_arena *arena)
+{
+    if (arena == NULL)
+        return;
+    Secure_Free(arena->state);
+    Secure_Free(arena->cache);
+    free(arena);
+}
@@ -0,0 +1,219 @@
+#include "header.h"
+
+/*
+*   Batch generate
+*
+*   Each state needs its own key schedule (expanded together by
+*   EncKeySetup_Batch), after that its counter blocks are independent of
+*   every other state's. One request of BATCH_STATES
+*   states is laid out as a single block list (state-major, output blocks
+*   then the LEN_SEED update blocks), with a round key pointer per block, so
+*   ecb_keys fills every SIMD lane even when each state asks for 16 bytes.
+*/
+typedef struct _BATCH {
+    u8 round_key[BATCH_STATES][ROUND_KEY_LEN];
+    u8 seed[BATCH_STATES][SEED_LEN];
+    u8 temp[BATCH_STATES][SEED_LEN];
+    u8 last[BATCH_STATES][BLOCK_SIZE];
+    u8 block[BATCH_BLOCKS * BLOCK_SIZE];
+    const u8 *keys[BATCH_BLOCKS];
+    u8 *dst[BATCH_BLOCKS];
+} st_batch;
+
+static void batch_flush(st_batch *batch, int R, size_t n)
+{
+    Kernel()->ecb_keys(batch->keys, R, batch->block, batch->block, n);
+    for (size_t cnt_i = 0; cnt_i < n; cnt_i++)
+    {
+        memcpy(batch->dst[cnt_i], batch->block + BLOCK_SIZE * cnt_i, BLOCK_SIZE);
+    }
+}
+
+//! generate_request for count <= BATCH_STATES states, len <= MAX_REQUEST_LEN
+static void batch_request(st_batch *batch, st_state **state, int count, u8 **random, size_t offset, size_t len)
+{
+    size_t full = len / BLOCK_SIZE;
+    size_t out_blocks = (len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    size_t n = 0;
+    const u8 *key[BATCH_STATES];
+    u8 *round_key[BATCH_STATES];
+    int R;
+
+    for (int cnt_i = 0; cnt_i < count; cnt_i++)
+    {
+        key[cnt_i] = state[cnt_i]->key;
+        round_key[cnt_i] = batch->round_key[cnt_i];
+    }
+    R = EncKeySetup_Batch(key, round_key, count, KEY_BIT);
+
+    for (int cnt_i = 0; cnt_i < count; cnt_i++)
+    {
+        for (size_t cnt_j = 0; cnt_j < out_blocks + LEN_SEED; cnt_j++)
+        {
+            //! update seed is key || V after the output blocks
+            if (cnt_j == out_blocks)
+                copy_state_seed(batch->seed[cnt_i], state[cnt_i]);
+            Counter_Add(state[cnt_i]->V, 1);
+            memcpy(batch->block + BLOCK_SIZE * n, state[cnt_i]->V, BLOCK_SIZE);
+            batch->keys[n] = batch->round_key[cnt_i];
+            if (cnt_j < full)
+                batch->dst[n] = random[cnt_i] + offset + BLOCK_SIZE * cnt_j;
+            else if (cnt_j < out_blocks)
+                batch->dst[n] = batch->last[cnt_i];
+            else
+                batch->dst[n] = batch->temp[cnt_i] + BLOCK_SIZE * (cnt_j - out_blocks);
+            if (++n == BATCH_BLOCKS)
+            {
+                batch_flush(batch, R, n);
+                n = 0;
+            }
+        }
+    }
+    if (n != 0)
+        batch_flush(batch, R, n);
+
+    for (int cnt_i = 0; cnt_i < count; cnt_i++)
+    {
+        memcpy(random[cnt_i] + offset + BLOCK_SIZE * full, batch->last[cnt_i], len % BLOCK_SIZE);
+        for (int cnt_j = 0; cnt_j < KEY_SIZE; cnt_j++)
+        {
+            state[cnt_i]->key[cnt_j] = batch->temp[cnt_i][cnt_j] ^ batch->seed[cnt_i][cnt_j];
+        }
+        for (int cnt_j = 0; cnt_j < BLOCK_SIZE; cnt_j++)
+        {
+            state[cnt_i]->V[cnt_j] = batch->temp[cnt_i][KEY_SIZE + cnt_j] ^ batch->seed[cnt_i][KEY_SIZE + cnt_j];
+        }
+    }
+}
+
+/*
+*   generate_Bytes on count states at once: random[i] receives len bytes
+*   of state[i]. re_add_data may be NULL, or hold one entry (or NULL) per
+*   state, the additional input of prediction-resistance reseeds as in
+*   generate_Bytes. FALSE as generate_Bytes.
+*/
+int generate_Batch(st_state **state, int count, u8 **random, size_t len, u8 **re_add_data)
+{
+    st_batch batch;
+    size_t offset = 0;
+
+    do
+    {
+        size_t n = len - offset < MAX_REQUEST_LEN ? len - offset : MAX_REQUEST_LEN;
+
+        for (int cnt_i = 0; cnt_i < count; cnt_i += BATCH_STATES)
+        {
+            int m = count - cnt_i < BATCH_STATES ? count - cnt_i : BATCH_STATES;
+
+            for (int cnt_j = cnt_i; cnt_j < cnt_i + m; cnt_j++)
+            {
+                if (!Reseed_Check(state[cnt_j], n) || (state[cnt_j]->prediction_flag == TRUE &&
+                    !Reseed_Prediction(state[cnt_j], re_add_data != NULL && offset == 0 ? re_add_data[cnt_j] : NULL)))
+                {
+                    clear((u8 *)&batch, sizeof(st_batch));
+                    return FALSE;
+                }
+            }
+            batch_request(&batch, state + cnt_i, m, random + cnt_i, offset, n);
+            for (int cnt_j = cnt_i; cnt_j < cnt_i + m; cnt_j++)
+            {
+                state[cnt_j]->Reseed_counter++;
+                state[cnt_j]->Reseed_bytes += n;
+            }
+        }
+        offset += n;
+    } while (offset < len);
+
+    clear((u8 *)&batch, sizeof(st_batch));
+    return TRUE;
+}
+
+/*
+*   Instantiate on count states. The derivation function's BCC chains all
+*   run under the fixed CBC_KEY, so the LEN_SEED chains of every instance
+*   go through cbc_mac_chains together. The update that follows runs on the
+*   all-zero state, its keystream is the same for every instance.
+*/
+void Instantiate_Batch(st_state **state, int count, u8 **in)
+{
+    static const u8 CBC_KEY[32] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f};
+    const st_kernel *kernel = Kernel();
+    u8 msg[BATCH_STATES * LEN_SEED][DF_INPUT_LEN];
+    const u8 *msgs[BATCH_STATES * LEN_SEED];
+    u8 KEYandV[BATCH_STATES][LEN_SEED * BLOCK_SIZE];
+    u8 X[BATCH_STATES][BLOCK_SIZE];
+    u8 round_key[BATCH_STATES][ROUND_KEY_LEN];
+    const u8 *keys[BATCH_STATES], *rks[BATCH_STATES];
+    u8 *round_keys[BATCH_STATES];
+    u8 temp[SEED_LEN] = {0x00};
+    u8 key[KEY_SIZE] = {0x00};
+    u8 V[BLOCK_SIZE] = {0x00};
+    u8 cbc_round_key[ROUND_KEY_LEN];
+    int cbc_R, R;
+
+    cbc_R = kernel->key_setup(CBC_KEY, cbc_round_key, KEY_BIT);
+    //! update_first_call on a cleared state
+    R = kernel->key_setup(key, round_key[0], KEY_BIT);
+    kernel->ctr(round_key[0], R, V, temp, LEN_SEED);
+
+    for (int base = 0; base < count; base += BATCH_STATES)
+    {
+        int n = count - base < BATCH_STATES ? count - base : BATCH_STATES;
+
+        //! step1, chain j of instance i is KEYandV[i] block j
+        for (int cnt_i = 0; cnt_i < n; cnt_i++)
+        {
+            df_input(in[base + cnt_i], msg[LEN_SEED * cnt_i]);
+            for (int cnt_j = 0; cnt_j < LEN_SEED; cnt_j++)
+            {
+                if (cnt_j != 0)
+                {
+                    memcpy(msg[LEN_SEED * cnt_i + cnt_j], msg[LEN_SEED * cnt_i], DF_INPUT_LEN);
+                    msg[LEN_SEED * cnt_i + cnt_j][3] += (u8)cnt_j;
+                }
+                msgs[LEN_SEED * cnt_i + cnt_j] = msg[LEN_SEED * cnt_i + cnt_j];
+            }
+        }
+        memset(KEYandV, 0, sizeof(KEYandV));
+        kernel->cbc_mac_chains(cbc_round_key, cbc_R, KEYandV[0], msgs, (size_t)n * LEN_SEED, DF_INPUT_LEN / 16);
+
+        //! step2
+        for (int cnt_i = 0; cnt_i < n; cnt_i++)
+        {
+            keys[cnt_i] = KEYandV[cnt_i];
+            round_keys[cnt_i] = round_key[cnt_i];
+            rks[cnt_i] = round_key[cnt_i];
+            memcpy(X[cnt_i], KEYandV[cnt_i] + KEY_SIZE, BLOCK_SIZE);
+        }
+        R = EncKeySetup_Batch(keys, round_keys, n, KEY_BIT);
+        for (int cnt_j = 0; cnt_j < LEN_SEED; cnt_j++)
+        {
+            kernel->ecb_keys(rks, R, X[0], X[0], n);
+            for (int cnt_i = 0; cnt_i < n; cnt_i++)
+            {
+                memcpy(KEYandV[cnt_i] + BLOCK_SIZE * cnt_j, X[cnt_i], BLOCK_SIZE);
+            }
+        }
+
+        for (int cnt_i = 0; cnt_i < n; cnt_i++)
+        {
+            st_state *st = state[base + cnt_i];
+
+            clear((u8 *)st, sizeof(st_state));
+            for (int cnt_j = 0; cnt_j < KEY_SIZE; cnt_j++)
+            {
+                st->key[cnt_j] = temp[cnt_j] ^ KEYandV[cnt_i][cnt_j];
+            }
+            for (int cnt_j = 0; cnt_j < BLOCK_SIZE; cnt_j++)
+            {
+                st->V[cnt_j] = temp[KEY_SIZE + cnt_j] ^ KEYandV[cnt_i][KEY_SIZE + cnt_j];
+            }
+            st->fork_gen = Fork_Generation();
+        }
+    }
+
+    clear(msg[0], sizeof(msg));
+    clear(KEYandV[0], sizeof(KEYandV));
+    clear(X[0], sizeof(X));
+    clear(round_key[0], sizeof(round_key));
+}
@@ -0,0 +1,67 @@
+#include "header.h"
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*
+*   Daemon client
+*   Blocking calls on one connection; requests above DAEMON_MAX_REQUEST
+*   are sent as several. A connection is not thread-safe, open one per
+*   thread.
+*/
+int DRBG_Client_Open(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (path == NULL)
+        path = DAEMON_SOCKET;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+    strcpy(addr.sun_path, path);
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+//! FALSE if the daemon went away; out may then be partly filled
+int DRBG_Client_Read(int fd, u8 *out, size_t len)
+{
+    while (len > 0)
+    {
+        size_t n = len < DAEMON_MAX_REQUEST ? len : DAEMON_MAX_REQUEST;
+        u8 head[4] = {(u8)(n >> 24), (u8)(n >> 16), (u8)(n >> 8), (u8)n};
+        size_t got = 0;
+
+        if (send(fd, head, 4, MSG_NOSIGNAL) != 4)
+            return FALSE;
+        while (got < n)
+        {
+            ssize_t r = recv(fd, out + got, n - got, 0);
+
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r <= 0)
+                return FALSE;
+            got += (size_t)r;
+        }
+        out += n;
+        len -= n;
+    }
+    return TRUE;
+}
+
+void DRBG_Client_Close(int fd)
+{
+    if (fd >= 0)
+        close(fd);
+}
@@ -0,0 +1,188 @@
+#include "header.h"
+
+/*
+*   Streaming conditioner
+*
+*   Every CONDITION_OUT output bytes are Block_Cipher_df (SP 800-90A 10.3.2)
+*   of in_len = ratio * CONDITION_OUT raw bytes. The BCC input of a chunk is
+*   IV_j || L || N || chunk || 0x80 || 0^*, and only the IV differs between
+*   its LEN_SEED chains, so every chain starts from E_K(IV_j) and all of
+*   them read the same message from block 1 on. Raw bytes are copied
+*   straight into the message of their chunk; CONDITION_CHUNKS messages go
+*   through cbc_mac_chains together, then EncKeySetup_Batch and ecb_keys.
+*/
+struct _CONDITIONER {
+    size_t in_len;   // raw bytes per CONDITION_OUT output bytes
+    size_t msg_len;  // BCC input after the IV block, whole blocks
+    size_t chunks;   // complete messages waiting
+    size_t pos;      // raw bytes in message chunks
+    u8 *msg;         // CONDITION_CHUNKS messages of msg_len bytes
+    u8 iv_chain[LEN_SEED][BLOCK_SIZE];
+    u8 round_key[ROUND_KEY_LEN];
+    int R;
+};
+
+static void put_be32(u8 *p, size_t x)
+{
+    p[0] = (u8)(x >> 24);
+    p[1] = (u8)(x >> 16);
+    p[2] = (u8)(x >> 8);
+    p[3] = (u8)x;
+}
+
+//! ratio is clamped to [1, CONDITION_MAX_RATIO]
+st_conditioner *Condition_New(unsigned int ratio)
+{
+    u8 CBC_KEY[KEY_SIZE];
+    u8 iv[LEN_SEED][BLOCK_SIZE] = {{0x00}};
+    st_conditioner *cond = (st_conditioner *)calloc(1, sizeof(st_conditioner));
+
+    if (cond == NULL)
+        return NULL;
+    if (ratio < 1)
+        ratio = 1;
+    if (ratio > CONDITION_MAX_RATIO)
+        ratio = CONDITION_MAX_RATIO;
+    cond->in_len = (size_t)ratio * CONDITION_OUT;
+    cond->msg_len = (8 + cond->in_len + 1 + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+    cond->msg = (u8 *)Secure_Alloc(CONDITION_CHUNKS * cond->msg_len, 0);
+    if (cond->msg == NULL)
+    {
+        free(cond);
+        return NULL;
+    }
+
+    //! L || N in front and 0x80 behind every chunk never change
+    for (int cnt_i = 0; cnt_i < CONDITION_CHUNKS; cnt_i++)
+    {
+        u8 *msg = cond->msg + cond->msg_len * cnt_i;
+
+        put_be32(msg, cond->in_len);
+        put_be32(msg + 4, CONDITION_OUT);
+        msg[8 + cond->in_len] = 0x80;
+    }
+
+    for (int cnt_i = 0; cnt_i < KEY_SIZE; cnt_i++)
+    {
+        CBC_KEY[cnt_i] = (u8)cnt_i;
+    }
+    cond->R = Kernel()->key_setup(CBC_KEY, cond->round_key, KEY_BIT);
+    for (int cnt_j = 0; cnt_j < LEN_SEED; cnt_j++)
+    {
+        put_be32(iv[cnt_j], (size_t)cnt_j);
+    }
+    Kernel()->ecb(cond->round_key, cond->R, iv[0], cond->iv_chain[0], LEN_SEED);
+    return cond;
+}
+
+//! Block_Cipher_df of the n waiting chunks into out, n * CONDITION_OUT bytes
+static void condition_flush(st_conditioner *cond, u8 *out)
+{
+    const st_kernel *kernel = Kernel();
+    size_t n = cond->chunks;
+    u8 chain[CONDITION_CHUNKS * LEN_SEED * BLOCK_SIZE];
+    const u8 *msgs[CONDITION_CHUNKS * LEN_SEED];
+    u8 X[CONDITION_CHUNKS][BLOCK_SIZE];
+    u8 round_key[CONDITION_CHUNKS][ROUND_KEY_LEN];
+    const u8 *keys[CONDITION_CHUNKS], *rks[CONDITION_CHUNKS];
+    u8 *round_keys[CONDITION_CHUNKS];
+    int R;
+
+    //! step1, chain j of chunk i is KEYandV of chunk i, block j
+    for (size_t cnt_i = 0; cnt_i < n; cnt_i++)
+    {
+        for (int cnt_j = 0; cnt_j < LEN_SEED; cnt_j++)
+        {
+            memcpy(chain + BLOCK_SIZE * (LEN_SEED * cnt_i + cnt_j), cond->iv_chain[cnt_j], BLOCK_SIZE);
+            msgs[LEN_SEED * cnt_i + cnt_j] = cond->msg + cond->msg_len * cnt_i;
+        }
+    }
+    kernel->cbc_mac_chains(cond->round_key, cond->R, chain, msgs, n * LEN_SEED, cond->msg_len / BLOCK_SIZE);
+
+    //! step2
+    for (size_t cnt_i = 0; cnt_i < n; cnt_i++)
+    {
+        keys[cnt_i] = chain + CONDITION_OUT * cnt_i;
+        round_keys[cnt_i] = round_key[cnt_i];
+        rks[cnt_i] = round_key[cnt_i];
+        memcpy(X[cnt_i], chain + CONDITION_OUT * cnt_i + KEY_SIZE, BLOCK_SIZE);
+    }
+    R = EncKeySetup_Batch(keys, round_keys, (int)n, KEY_BIT);
+    for (int cnt_j = 0; cnt_j < LEN_SEED; cnt_j++)
+    {
+        kernel->ecb_keys(rks, R, X[0], X[0], n);
+        for (size_t cnt_i = 0; cnt_i < n; cnt_i++)
+        {
+            memcpy(out + CONDITION_OUT * cnt_i + BLOCK_SIZE * cnt_j, X[cnt_i], BLOCK_SIZE);
+        }
+    }
+
+    for (size_t cnt_i = 0; cnt_i < n; cnt_i++)
+    {
+        memset(cond->msg + cond->msg_len * cnt_i + 8, 0, cond->in_len);
+    }
+    cond->chunks = 0;
+    clear(chain, sizeof(chain));
+    clear(X[0], sizeof(X));
+    clear(round_key[0], (int)(n * ROUND_KEY_LEN));
+}
+
+//! output bytes the next Condition_Feed of len raw bytes writes
+size_t Condition_Output_Len(const st_conditioner *cond, size_t len)
+{
+    return (cond->chunks + (cond->pos + len) / cond->in_len) * CONDITION_OUT;
+}
+
+/*
+*   Ingest len raw bytes. Every complete chunk is conditioned before
+*   returning, a partial one waits for the next call. out must hold
+*   Condition_Output_Len(cond, len) bytes; returns the bytes written.
+*/
+size_t Condition_Feed(st_conditioner *cond, const u8 *raw, size_t len, u8 *out)
+{
+    size_t written = 0;
+
+    while (len > 0)
+    {
+        size_t n = cond->in_len - cond->pos < len ? cond->in_len - cond->pos : len;
+
+        memcpy(cond->msg + cond->msg_len * cond->chunks + 8 + cond->pos, raw, n);
+        cond->pos += n;
+        raw += n;
+        len -= n;
+        if (cond->pos < cond->in_len)
+            break;
+
+        cond->pos = 0;
+        if (++cond->chunks == CONDITION_CHUNKS)
+        {
+            condition_flush(cond, out + written);
+            written += CONDITION_CHUNKS * CONDITION_OUT;
+        }
+    }
+    if (cond->chunks != 0)
+    {
+        size_t n = cond->chunks * CONDITION_OUT;
+
+        condition_flush(cond, out + written);
+        written += n;
+        //! a partial chunk moves to the front
+        if (cond->pos != 0)
+        {
+            u8 *part = cond->msg + cond->msg_len * (n / CONDITION_OUT) + 8;
+
+            memcpy(cond->msg + 8, part, cond->pos);
+            memset(part, 0, cond->pos);
+        }
+    }
+    return written;
+}
+
+void Condition_Free(st_conditioner *cond)
+{
+    if (cond == NULL)
+        return;
+    Secure_Free(cond->msg);
+    clear((u8 *)cond, sizeof(st_conditioner));
+    free(cond);
+}
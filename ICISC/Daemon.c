@@ -0,0 +1,365 @@
+#define _GNU_SOURCE // accept4, pthread_setaffinity_np
+#include "header.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*
+*   Randomness daemon
+*
+*   Every worker owns an instance (split off a master instantiated from the
+*   entropy source) and an epoll set. All workers wait on the listening
+*   socket with EPOLLEXCLUSIVE, a connection stays with the worker that
+*   accepted it. A request is a 4-byte big-endian length, the reply is that
+*   many bytes. Requests of up to DAEMON_SMALL bytes that arrive in one
+*   epoll_wait round are served from a single generate into the worker's
+*   batch buffer, each connection getting its own disjoint slice of it;
+*   larger ones get a generate of their own. Bytes are erased once sent.
+*/
+typedef struct _DAEMON_CONN {
+    int fd;
+    u8 head[4];
+    size_t head_len;
+    size_t want;         // bytes requested, 0 while reading the header
+    u8 *out;             // reply being sent, want bytes
+    size_t sent;
+    struct _DAEMON_CONN *prev, *next; // the worker's connections
+} st_daemon_conn;
+
+typedef struct _DAEMON_WORKER {
+    st_daemon *daemon;
+    st_state state;
+    int epfd;
+    int cpu;
+    pthread_t thread;
+    st_daemon_conn *conns;
+    u8 batch[DAEMON_BATCH];
+    st_daemon_conn *ready[DAEMON_EVENTS];
+} st_daemon_worker;
+
+struct _DAEMON {
+    int listen_fd;
+    int workers;
+    _Atomic int running;
+    st_daemon_worker *worker;
+};
+
+static void conn_close(st_daemon_worker *w, st_daemon_conn *c)
+{
+    if (c->prev != NULL)
+        c->prev->next = c->next;
+    else
+        w->conns = c->next;
+    if (c->next != NULL)
+        c->next->prev = c->prev;
+    epoll_ctl(w->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    if (c->out != NULL)
+    {
+        clear(c->out, (int)c->want);
+        free(c->out);
+    }
+    free(c);
+}
+
+static void conn_watch(st_daemon_worker *w, st_daemon_conn *c, unsigned int events)
+{
+    struct epoll_event ev;
+
+    ev.events = events;
+    ev.data.ptr = c;
+    epoll_ctl(w->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+//! read the next header, TRUE while the connection lives
+static int conn_read(st_daemon_conn *c)
+{
+    while (c->head_len < 4)
+    {
+        ssize_t n = read(c->fd, c->head + c->head_len, 4 - c->head_len);
+
+        if (n == 0)
+            return FALSE;
+        if (n < 0)
+            return errno == EAGAIN || errno == EINTR;
+        c->head_len += (size_t)n;
+    }
+    c->want = ((size_t)c->head[0] << 24) | ((size_t)c->head[1] << 16) | ((size_t)c->head[2] << 8) | c->head[3];
+    c->head_len = 0;
+    return c->want != 0 && c->want <= DAEMON_MAX_REQUEST;
+}
+
+//! send what the socket takes, TRUE while the connection lives
+static int conn_write(st_daemon_worker *w, st_daemon_conn *c)
+{
+    while (c->sent < c->want)
+    {
+        ssize_t n = send(c->fd, c->out + c->sent, c->want - c->sent, MSG_NOSIGNAL);
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN)
+                return FALSE;
+            conn_watch(w, c, EPOLLOUT);
+            return TRUE;
+        }
+        c->sent += (size_t)n;
+    }
+    clear(c->out, (int)c->want);
+    free(c->out);
+    c->out = NULL;
+    c->want = 0;
+    c->sent = 0;
+    conn_watch(w, c, EPOLLIN);
+    return TRUE;
+}
+
+static void daemon_accept(st_daemon_worker *w)
+{
+    for (;;)
+    {
+        int fd = accept4(w->daemon->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        st_daemon_conn *c;
+        struct epoll_event ev;
+
+        if (fd < 0)
+            return;
+        c = (st_daemon_conn *)calloc(1, sizeof(st_daemon_conn));
+        if (c == NULL)
+        {
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, fd, &ev) != 0)
+        {
+            close(fd);
+            free(c);
+            continue;
+        }
+        c->next = w->conns;
+        if (w->conns != NULL)
+            w->conns->prev = c;
+        w->conns = c;
+    }
+}
+
+/*
+*   Replies for the n connections of this round: the small ones from one
+*   generate into the batch buffer, the large ones one generate each.
+*/
+static void daemon_serve(st_daemon_worker *w, int n)
+{
+    size_t small = 0, pos = 0;
+
+    for (int cnt_i = 0; cnt_i < n; cnt_i++)
+    {
+        if (w->ready[cnt_i]->want <= DAEMON_SMALL)
+            small += w->ready[cnt_i]->want;
+    }
+    if (small != 0 && !generate_Bytes(&w->state, w->batch, small, NULL))
+        small = 0;
+
+    for (int cnt_i = 0; cnt_i < n; cnt_i++)
+    {
+        st_daemon_conn *c = w->ready[cnt_i];
+        int ok;
+
+        c->out = (u8 *)malloc(c->want);
+        if (c->out == NULL)
+        {
+            conn_close(w, c);
+            continue;
+        }
+        if (c->want <= DAEMON_SMALL)
+        {
+            //! no entropy for a due reseed: drop the client rather than serve stale state
+            ok = small != 0;
+            if (ok)
+            {
+                memcpy(c->out, w->batch + pos, c->want);
+                pos += c->want;
+            }
+        }
+        else
+        {
+            ok = generate_Bytes(&w->state, c->out, c->want, NULL);
+        }
+        if (!ok || !conn_write(w, c))
+            conn_close(w, c);
+    }
+    clear(w->batch, (int)small);
+}
+
+static void *daemon_main(void *arg)
+{
+    st_daemon_worker *w = (st_daemon_worker *)arg;
+    struct epoll_event events[DAEMON_EVENTS];
+    cpu_set_t cpus;
+
+    //! one worker per core, its instance stays in that core's cache
+    CPU_ZERO(&cpus);
+    CPU_SET(w->cpu, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+    while (atomic_load(&w->daemon->running))
+    {
+        int count = epoll_wait(w->epfd, events, DAEMON_EVENTS, DAEMON_TICK_MS);
+        int n = 0;
+        size_t small = 0;
+
+        for (int cnt_i = 0; cnt_i < count; cnt_i++)
+        {
+            st_daemon_conn *c = (st_daemon_conn *)events[cnt_i].data.ptr;
+
+            if (c == NULL)
+            {
+                daemon_accept(w);
+                continue;
+            }
+            if (c->out != NULL)
+            {
+                if (!conn_write(w, c))
+                    conn_close(w, c);
+                continue;
+            }
+            if (!conn_read(c))
+            {
+                conn_close(w, c);
+                continue;
+            }
+            if (c->want == 0)
+                continue;
+            //! the batch buffer bounds one round, the rest waits for the next
+            if (c->want <= DAEMON_SMALL && small + c->want > DAEMON_BATCH)
+            {
+                daemon_serve(w, n);
+                n = 0;
+                small = 0;
+            }
+            if (c->want <= DAEMON_SMALL)
+                small += c->want;
+            w->ready[n++] = c;
+        }
+        if (n != 0)
+            daemon_serve(w, n);
+    }
+    return NULL;
+}
+
+//! workers 0 takes one per online CPU
+st_daemon *DRBG_Daemon_New(const char *path, int workers)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    st_daemon *daemon = (st_daemon *)calloc(1, sizeof(st_daemon));
+    struct sockaddr_un addr;
+    st_state master;
+    u8 in[INSTANCE_INPUT];
+
+    if (daemon == NULL)
+        return NULL;
+    if (cpus < 1)
+        cpus = 1;
+    if (workers < 1)
+        workers = (int)cpus;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        free(daemon);
+        return NULL;
+    }
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    daemon->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    daemon->worker = (st_daemon_worker *)Secure_Alloc((size_t)workers * sizeof(st_daemon_worker), SECURE_HUGE);
+    if (daemon->listen_fd < 0 || daemon->worker == NULL ||
+        bind(daemon->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(daemon->listen_fd, SOMAXCONN) != 0 || !Entropy_Read(NULL, in, INSTANCE_INPUT))
+    {
+        if (daemon->listen_fd >= 0)
+            close(daemon->listen_fd);
+        Secure_Free(daemon->worker);
+        free(daemon);
+        return NULL;
+    }
+    Instantiate(&master, in);
+    clear(in, INSTANCE_INPUT);
+
+    daemon->workers = workers;
+    for (int cnt_i = 0; cnt_i < workers; cnt_i++)
+    {
+        st_daemon_worker *w = &daemon->worker[cnt_i];
+        struct epoll_event ev;
+
+        w->daemon = daemon;
+        w->cpu = (int)(cnt_i % cpus);
+        w->epfd = epoll_create1(EPOLL_CLOEXEC);
+        ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+        ev.data.ptr = NULL;
+        if (w->epfd < 0 || epoll_ctl(w->epfd, EPOLL_CTL_ADD, daemon->listen_fd, &ev) != 0 ||
+            !DRBG_Split(&master, &w->state))
+        {
+            clear((u8 *)&master, sizeof(st_state));
+            daemon->workers = cnt_i + 1;
+            DRBG_Daemon_Free(daemon);
+            return NULL;
+        }
+    }
+    clear((u8 *)&master, sizeof(st_state));
+    return daemon;
+}
+
+//! serves on the calling thread and workers - 1 more until DRBG_Daemon_Stop
+int DRBG_Daemon_Run(st_daemon *daemon)
+{
+    int started = 0;
+
+    atomic_store(&daemon->running, TRUE);
+    Reseed_Prefetch_Start();
+    for (int cnt_i = 1; cnt_i < daemon->workers; cnt_i++)
+    {
+        if (pthread_create(&daemon->worker[cnt_i].thread, NULL, daemon_main, &daemon->worker[cnt_i]) != 0)
+            break;
+        started++;
+    }
+    daemon_main(&daemon->worker[0]);
+    for (int cnt_i = 1; cnt_i <= started; cnt_i++)
+        pthread_join(daemon->worker[cnt_i].thread, NULL);
+    Reseed_Prefetch_Stop();
+    return TRUE;
+}
+
+//! async-signal-safe, the workers notice within DAEMON_TICK_MS
+void DRBG_Daemon_Stop(st_daemon *daemon)
+{
+    atomic_store(&daemon->running, FALSE);
+}
+
+void DRBG_Daemon_Free(st_daemon *daemon)
+{
+    if (daemon == NULL)
+        return;
+    for (int cnt_i = 0; cnt_i < daemon->workers; cnt_i++)
+    {
+        st_daemon_worker *w = &daemon->worker[cnt_i];
+
+        while (w->conns != NULL)
+            conn_close(w, w->conns);
+        if (w->epfd > 0)
+            close(w->epfd);
+    }
+    close(daemon->listen_fd);
+    Secure_Free(daemon->worker);
+    free(daemon);
+}
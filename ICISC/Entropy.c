@@ -0,0 +1,250 @@
+#include "header.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <sys/random.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/*
+*   Entropy sources
+*
+*   A source is an st_entropy at the head of its own context struct.
+*   The getrandom source reads ENTROPY_BATCH bytes per syscall into a
+*   locked page that is kept out of core dumps and wiped on fork, hands
+*   them out in order and wipes every byte it hands out. The mock source is splitmix64 on a seed:
+*   the same seed gives the same entropy, for tests and benchmarks only.
+*   Both claim full entropy (h = 8) and run the health tests under their
+*   lock, on each getrandom batch and on each mock read. The jitter source
+*   is in Jitter.c.
+*/
+typedef struct _ENTROPY_GETRANDOM {
+    st_entropy base;
+    pthread_mutex_t lock;
+    u8 *buf;
+    size_t pos; // ENTROPY_BATCH when empty
+    unsigned long fork_gen; // generation the batch was read in
+} st_entropy_getrandom;
+
+typedef struct _ENTROPY_MOCK {
+    st_entropy base;
+    pthread_mutex_t lock;
+    unsigned long long x;
+    u8 word[8];
+    size_t used; // bytes of word already handed out
+} st_entropy_mock;
+
+static st_entropy *JITTER = NULL;
+static pthread_once_t JITTER_ONCE = PTHREAD_ONCE_INIT;
+
+static void jitter_init(void)
+{
+    JITTER = Entropy_Jitter_New();
+}
+
+/*
+*   A pool that is not initialized yet (early boot, fresh container) falls
+*   back to jitter. The kernel is asked directly, not through the libc
+*   getrandom symbol, which the preload shim (tools/ctrdrbg-preload.c)
+*   serves from this library.
+*/
+static int getrandom_fill(u8 *out, size_t len)
+{
+    while (len > 0)
+    {
+        long n = syscall(SYS_getrandom, out, len, GRND_NONBLOCK);
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN)
+                return FALSE;
+            pthread_once(&JITTER_ONCE, jitter_init);
+            return JITTER != NULL && Entropy_Read(JITTER, out, len);
+        }
+        out += n;
+        len -= (size_t)n;
+    }
+    return TRUE;
+}
+
+static int getrandom_read(st_entropy *src, u8 *out, size_t len)
+{
+    st_entropy_getrandom *gr = (st_entropy_getrandom *)src;
+    int ret = TRUE;
+
+    //! a batch or more gains nothing from the buffer
+    if (len >= ENTROPY_BATCH)
+    {
+        if (!getrandom_fill(out, len))
+            return FALSE;
+        pthread_mutex_lock(&gr->lock);
+        ret = Health_Test(&src->health, src->name, out, len);
+        pthread_mutex_unlock(&gr->lock);
+        if (!ret)
+            clear(out, (int)len);
+        return ret;
+    }
+
+    pthread_mutex_lock(&gr->lock);
+    if (src->health.failed)
+        ret = FALSE;
+    //! a forked child must not hand out what its parent hands out
+    if (gr->fork_gen != Fork_Generation())
+    {
+        clear(gr->buf, ENTROPY_BATCH);
+        gr->pos = ENTROPY_BATCH;
+        gr->fork_gen = Fork_Generation();
+    }
+    while (ret && len > 0)
+    {
+        size_t n;
+
+        if (gr->pos == ENTROPY_BATCH)
+        {
+            if (!getrandom_fill(gr->buf, ENTROPY_BATCH) || !Health_Test(&src->health, src->name, gr->buf, ENTROPY_BATCH))
+            {
+                clear(gr->buf, ENTROPY_BATCH);
+                ret = FALSE;
+                break;
+            }
+            gr->pos = 0;
+        }
+        n = ENTROPY_BATCH - gr->pos < len ? ENTROPY_BATCH - gr->pos : len;
+        memcpy(out, gr->buf + gr->pos, n);
+        memset(gr->buf + gr->pos, 0, n);
+        gr->pos += n;
+        out += n;
+        len -= n;
+    }
+    pthread_mutex_unlock(&gr->lock);
+    return ret;
+}
+
+static st_entropy_getrandom GETRANDOM = {{"getrandom", getrandom_read, NULL, {0}}, PTHREAD_MUTEX_INITIALIZER, NULL, ENTROPY_BATCH};
+static u8 GETRANDOM_FALLBACK[ENTROPY_BATCH];
+static pthread_once_t GETRANDOM_ONCE = PTHREAD_ONCE_INIT;
+
+static void getrandom_child(void)
+{
+    pthread_mutex_init(&GETRANDOM.lock, NULL);
+}
+
+static void getrandom_init(void)
+{
+    void *buf;
+
+    Health_Init(&GETRANDOM.base.health, 8.0);
+    pthread_atfork(NULL, NULL, getrandom_child);
+    buf = Secure_Alloc(ENTROPY_BATCH, SECURE_WIPE);
+    GETRANDOM.buf = buf != NULL ? (u8 *)buf : GETRANDOM_FALLBACK;
+}
+
+st_entropy *Entropy_Getrandom(void)
+{
+    pthread_once(&GETRANDOM_ONCE, getrandom_init);
+    return &GETRANDOM.base;
+}
+
+//! one byte stream, independent of how it is split into reads
+static int mock_read(st_entropy *src, u8 *out, size_t len)
+{
+    st_entropy_mock *mock = (st_entropy_mock *)src;
+    u8 *start = out;
+    size_t total = len;
+    int ret;
+
+    pthread_mutex_lock(&mock->lock);
+    if (src->health.failed)
+    {
+        pthread_mutex_unlock(&mock->lock);
+        return FALSE;
+    }
+    while (len > 0)
+    {
+        size_t n;
+
+        if (mock->used == 8)
+        {
+            unsigned long long z = (mock->x += 0x9e3779b97f4a7c15ULL);
+
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            z ^= z >> 31;
+            for (int cnt_i = 0; cnt_i < 8; cnt_i++)
+            {
+                mock->word[cnt_i] = (u8)(z >> (8 * cnt_i));
+            }
+            mock->used = 0;
+        }
+        n = 8 - mock->used < len ? 8 - mock->used : len;
+        memcpy(out, mock->word + mock->used, n);
+        mock->used += n;
+        out += n;
+        len -= n;
+    }
+    ret = Health_Test(&src->health, src->name, start, total);
+    pthread_mutex_unlock(&mock->lock);
+    if (!ret)
+        clear(start, (int)total);
+    return ret;
+}
+
+static void mock_release(st_entropy *src)
+{
+    st_entropy_mock *mock = (st_entropy_mock *)src;
+
+    pthread_mutex_destroy(&mock->lock);
+    clear((u8 *)mock, sizeof(st_entropy_mock));
+    free(mock);
+}
+
+//! NOT random: a reproducible stream for tests and benchmarks
+st_entropy *Entropy_Mock_New(unsigned long long seed)
+{
+    st_entropy_mock *mock = (st_entropy_mock *)calloc(1, sizeof(st_entropy_mock));
+
+    if (mock == NULL)
+        return NULL;
+    mock->base.name = "mock";
+    mock->base.read = mock_read;
+    mock->base.release = mock_release;
+    pthread_mutex_init(&mock->lock, NULL);
+    Health_Init(&mock->base.health, 8.0);
+    mock->x = seed;
+    mock->used = 8;
+    return &mock->base;
+}
+
+void Entropy_Free(st_entropy *src)
+{
+    if (src != NULL && src->release != NULL)
+        src->release(src);
+}
+
+/*
+*   Default source
+*   Read by the reseed policy and its prefetch thread. Switch it before
+*   starting the prefetch thread, or inputs already read stay in its ring.
+*/
+static st_entropy *_Atomic DEFAULT_SOURCE = NULL;
+
+void Entropy_Set(st_entropy *src)
+{
+    atomic_store(&DEFAULT_SOURCE, src);
+}
+
+st_entropy *Entropy_Default(void)
+{
+    st_entropy *src = atomic_load(&DEFAULT_SOURCE);
+
+    return src != NULL ? src : Entropy_Getrandom();
+}
+
+int Entropy_Read(st_entropy *src, u8 *out, size_t len)
+{
+    if (src == NULL)
+        src = Entropy_Default();
+    return src->read(src, out, len);
+}
@@ -0,0 +1,244 @@
+#define _GNU_SOURCE // O_DIRECT
+#include "header.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__linux__)
+#include <linux/fs.h>
+#endif
+
+/*
+*   File fill
+*
+*   The target is cut into FILL_ALIGN-aligned segments, each filled by its
+*   own thread from its own instance, split off one freshly instantiated
+*   parent. FILL_DIRECT writes FILL_BUFFER chunks from an aligned buffer
+*   through O_DIRECT (the unaligned tail, if any, through the page cache);
+*   FILL_MMAP generates straight into a MADV_SEQUENTIAL mapping of the
+*   segment, without a copy; otherwise it is pwrite through the page cache.
+*   The calling thread reports progress every FILL_PROGRESS_MS.
+*/
+typedef struct _FILL {
+    int fd, fd_direct;
+    unsigned int flags;
+    _Atomic unsigned long long done;
+    _Atomic int failed;
+} st_fill;
+
+typedef struct _FILL_SEGMENT {
+    st_fill *fill;
+    st_state state;
+    unsigned long long start, len;
+    pthread_t thread;
+} st_fill_segment;
+
+static double fill_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int fill_pwrite(int fd, const u8 *buf, size_t len, unsigned long long offset)
+{
+    while (len > 0)
+    {
+        ssize_t n = pwrite(fd, buf, len, (off_t)offset);
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return FALSE;
+        }
+        buf += n;
+        len -= (size_t)n;
+        offset += (unsigned long long)n;
+    }
+    return TRUE;
+}
+
+static int fill_mapped(st_fill_segment *seg)
+{
+    st_fill *fill = seg->fill;
+    u8 *map = (u8 *)mmap(NULL, seg->len, PROT_READ | PROT_WRITE, MAP_SHARED, fill->fd, (off_t)seg->start);
+
+    if (map == MAP_FAILED)
+        return FALSE;
+    madvise(map, seg->len, MADV_SEQUENTIAL);
+    for (unsigned long long pos = 0; pos < seg->len && !atomic_load(&fill->failed); pos += FILL_BUFFER)
+    {
+        size_t n = (size_t)(seg->len - pos < FILL_BUFFER ? seg->len - pos : FILL_BUFFER);
+
+        if (!generate_Bytes(&seg->state, map + pos, n, NULL))
+        {
+            munmap(map, seg->len);
+            return FALSE;
+        }
+        //! start writeback behind the generator, written pages need no second visit
+        msync(map + pos, n, MS_ASYNC);
+        atomic_fetch_add(&fill->done, n);
+    }
+    return munmap(map, seg->len) == 0;
+}
+
+static int fill_written(st_fill_segment *seg)
+{
+    st_fill *fill = seg->fill;
+    u8 *buf = (u8 *)Secure_Alloc(FILL_BUFFER, SECURE_HUGE);
+    int ret = TRUE;
+
+    if (buf == NULL)
+        return FALSE;
+    for (unsigned long long pos = 0; pos < seg->len && ret && !atomic_load(&fill->failed); pos += FILL_BUFFER)
+    {
+        size_t n = (size_t)(seg->len - pos < FILL_BUFFER ? seg->len - pos : FILL_BUFFER);
+        size_t aligned = fill->fd_direct >= 0 ? n & ~(size_t)(FILL_ALIGN - 1) : 0;
+
+        ret = generate_Bytes(&seg->state, buf, n, NULL);
+        if (ret && aligned != 0)
+            ret = fill_pwrite(fill->fd_direct, buf, aligned, seg->start + pos);
+        if (ret && aligned != n)
+            ret = fill_pwrite(fill->fd, buf + aligned, n - aligned, seg->start + pos + aligned);
+        if (ret)
+            atomic_fetch_add(&fill->done, n);
+    }
+    Secure_Free(buf);
+    return ret;
+}
+
+static void *fill_main(void *arg)
+{
+    st_fill_segment *seg = (st_fill_segment *)arg;
+    int ok = (seg->fill->flags & FILL_MMAP) ? fill_mapped(seg) : fill_written(seg);
+
+    if (!ok)
+        atomic_store(&seg->fill->failed, TRUE);
+    return NULL;
+}
+
+//! bytes of a block device or regular file, 0 when unknown
+static unsigned long long fill_size(int fd)
+{
+    struct stat st;
+
+    if (fstat(fd, &st) != 0)
+        return 0;
+#if defined(BLKGETSIZE64)
+    if (S_ISBLK(st.st_mode))
+    {
+        unsigned long long size = 0;
+
+        return ioctl(fd, BLKGETSIZE64, &size) == 0 ? size : 0;
+    }
+#endif
+    return (unsigned long long)st.st_size;
+}
+
+/*
+*   Fill size bytes of path with DRBG output on segments threads; size 0
+*   keeps the current size of the file or device. progress, if not NULL,
+*   gets bytes done, total and seconds elapsed, and once more at the end.
+*   FALSE if any segment failed.
+*/
+int DRBG_File_Fill(const char *path, unsigned long long size, int segments, unsigned int flags,
+                   void (*progress)(unsigned long long done, unsigned long long total, double seconds, void *arg), void *arg)
+{
+    st_fill fill;
+    st_fill_segment *seg;
+    struct stat st;
+    st_state parent;
+    u8 in[INSTANCE_INPUT];
+    unsigned long long each;
+    double start = fill_now();
+    int started = 0, ret;
+
+    memset(&fill, 0, sizeof(st_fill));
+    fill.flags = flags;
+    fill.fd_direct = -1;
+    fill.fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (fill.fd < 0)
+        return FALSE;
+    if (size == 0)
+        size = fill_size(fill.fd);
+    //! a mapping needs a regular file to be that long already
+    if (fstat(fill.fd, &st) != 0 || (S_ISREG(st.st_mode) && size > (unsigned long long)st.st_size &&
+                                     ftruncate(fill.fd, (off_t)size) != 0))
+    {
+        close(fill.fd);
+        return FALSE;
+    }
+#if defined(O_DIRECT)
+    //! not every filesystem takes O_DIRECT, then the page cache it is
+    if ((flags & FILL_DIRECT) && !(flags & FILL_MMAP))
+        fill.fd_direct = open(path, O_WRONLY | O_DIRECT);
+#endif
+
+    if (segments < 1)
+        segments = 1;
+    if (segments > FILL_SEGMENTS_MAX)
+        segments = FILL_SEGMENTS_MAX;
+    each = (size / (unsigned long long)segments + FILL_ALIGN - 1) & ~(unsigned long long)(FILL_ALIGN - 1);
+    seg = (st_fill_segment *)Secure_Alloc((size_t)segments * sizeof(st_fill_segment), 0);
+    if (seg == NULL || !Entropy_Read(NULL, in, INSTANCE_INPUT))
+    {
+        Secure_Free(seg);
+        close(fill.fd);
+        if (fill.fd_direct >= 0)
+            close(fill.fd_direct);
+        return FALSE;
+    }
+    Instantiate(&parent, in);
+    clear(in, INSTANCE_INPUT);
+
+    for (int cnt_i = 0; cnt_i < segments; cnt_i++)
+    {
+        seg[cnt_i].fill = &fill;
+        seg[cnt_i].start = each * (unsigned long long)cnt_i;
+        if (seg[cnt_i].start >= size)
+            break;
+        seg[cnt_i].len = size - seg[cnt_i].start < each ? size - seg[cnt_i].start : each;
+        if (!DRBG_Split(&parent, &seg[cnt_i].state) ||
+            pthread_create(&seg[cnt_i].thread, NULL, fill_main, &seg[cnt_i]) != 0)
+        {
+            atomic_store(&fill.failed, TRUE);
+            break;
+        }
+        started++;
+    }
+    clear((u8 *)&parent, sizeof(st_state));
+
+    if (progress != NULL)
+    {
+        double next = start + FILL_PROGRESS_MS * 1e-3;
+
+        //! short naps, a small fill should not wait out a whole period
+        while (atomic_load(&fill.done) < size && !atomic_load(&fill.failed))
+        {
+            usleep(10000);
+            if (fill_now() >= next)
+            {
+                progress(atomic_load(&fill.done), size, fill_now() - start, arg);
+                next += FILL_PROGRESS_MS * 1e-3;
+            }
+        }
+    }
+    for (int cnt_i = 0; cnt_i < started; cnt_i++)
+        pthread_join(seg[cnt_i].thread, NULL);
+
+    ret = !atomic_load(&fill.failed) && fdatasync(fill.fd) == 0;
+    if (progress != NULL)
+        progress(atomic_load(&fill.done), size, fill_now() - start, arg);
+    if (fill.fd_direct >= 0)
+        close(fill.fd_direct);
+    close(fill.fd);
+    Secure_Free(seg);
+    return ret;
+}
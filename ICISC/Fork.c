@@ -0,0 +1,99 @@
+#include "header.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/*
+*   Fork detection
+*
+*   The generation starts at 0 and goes up by one in every child: a
+*   pthread_atfork child handler catches fork() through libc, and a
+*   MADV_WIPEONFORK page that reads zero in a child catches raw clone and
+*   fork system calls as well. Every state records the generation it was
+*   (re)seeded in; Reseed_Check compares it with the current one before
+*   each request, so a child reseeds from fresh entropy before its first
+*   output. Buffers of output or entropy (pool, getrandom batch, prefetch)
+*   are dropped the same way, and those that are page-backed are wiped by
+*   the kernel at fork, the child never holds their bytes at all.
+*/
+static _Atomic unsigned long FORK_GEN = 0;
+static volatile u8 *FORK_PAGE = NULL;
+static pthread_once_t FORK_ONCE = PTHREAD_ONCE_INIT;
+static _Atomic int FORK_READY = FALSE;
+
+static void fork_child(void)
+{
+    atomic_fetch_add(&FORK_GEN, 1);
+    if (FORK_PAGE != NULL)
+        FORK_PAGE[0] = 1;
+}
+
+static void fork_init(void)
+{
+    void *page = mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (page != MAP_FAILED)
+    {
+        if (Fork_Wipe(page, 4096))
+        {
+            FORK_PAGE = (volatile u8 *)page;
+            FORK_PAGE[0] = 1;
+        }
+        else
+        {
+            munmap(page, 4096);
+        }
+    }
+    pthread_atfork(NULL, NULL, fork_child);
+    atomic_store_explicit(&FORK_READY, TRUE, memory_order_release);
+}
+
+unsigned long Fork_Generation(void)
+{
+    //! called before every request, the pthread_once call is kept off that path
+    if (!atomic_load_explicit(&FORK_READY, memory_order_acquire))
+        pthread_once(&FORK_ONCE, fork_init);
+    //! a child the atfork handler did not see
+    if (FORK_PAGE != NULL && FORK_PAGE[0] == 0)
+    {
+        FORK_PAGE[0] = 1;
+        atomic_fetch_add(&FORK_GEN, 1);
+    }
+    return atomic_load_explicit(&FORK_GEN, memory_order_relaxed);
+}
+
+/*
+*   Reseed state from RESEED_ENTROPY_LEN bytes of the entropy source, the
+*   full security strength, with the pid and generation as additional
+*   input so that no two children derive the same state even from a shared
+*   source, and stamp the current generation.
+*/
+int Fork_Reseed(st_state *state)
+{
+    u8 in[RESEED_ENTROPY_LEN];
+    unsigned long add[2];
+    int ret;
+
+    if (!Entropy_Read(NULL, in, RESEED_ENTROPY_LEN))
+        return FALSE;
+    add[0] = (unsigned long)getpid();
+    add[1] = Fork_Generation();
+    ret = Reseed_Input(state, in, RESEED_ENTROPY_LEN, (const u8 *)add, sizeof(add));
+    clear(in, RESEED_ENTROPY_LEN);
+    if (ret)
+        state->fork_gen = add[1];
+    return ret;
+}
+
+//! page-aligned ptr, len; FALSE where the kernel has no MADV_WIPEONFORK (before 4.14)
+int Fork_Wipe(void *ptr, size_t len)
+{
+#if defined(MADV_WIPEONFORK)
+    return madvise(ptr, len, MADV_WIPEONFORK) == 0;
+#else
+    (void)ptr;
+    (void)len;
+    return FALSE;
+#endif
+}
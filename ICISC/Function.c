@@ -1,56 +1,63 @@
 #include "header.h"
 
-void derived_function(u8 *input_data, u8 *seed)
+//! DF_INPUT_LEN bytes of BCC input for the first chain, in[3] is the chain counter
+void df_input(const u8 *input_data, u8 *in)
 {
-    volatile int cnt_i = 0, cnt_j = 0, cnt_k = 0;
-    u8 CBC_KEY[32] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f};
-    u8 chain_value[BLOCK_SIZE] = {0x00};
-    u8 KEYandV[LEN_SEED * BLOCK_SIZE] = {0x00};
-    u8 in[DF_INPUT_LEN] = {0x00};
+    volatile int cnt_i = 0;
 
+    memset(in, 0, DF_INPUT_LEN);
     for (cnt_i = 0; cnt_i < INSTANCE_INPUT; cnt_i++)
     {
         in[cnt_i + 24] = input_data[cnt_i];
     }
-    in[cnt_i] = N_CONSTANT;
     in[19] = INSTANCE_INPUT;
     in[23] = N_DF;
     in[24 + INSTANCE_INPUT] = 0x80;
+}
+
+void derived_function(u8 *input_data, u8 *seed)
+{
+    volatile int cnt_i = 0, cnt_j = 0, cnt_k = 0;
+    const st_kernel *kernel = Kernel();
+    u8 CBC_KEY[32] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f};
+    u8 chain_value[BLOCK_SIZE] = {0x00};
+    u8 KEYandV[LEN_SEED * BLOCK_SIZE] = {0x00};
+    u8 in[DF_INPUT_LEN] = {0x00};
+    int R = 0;
+
+    df_input(input_data, in);
 
     u8 state[BLOCK_SIZE] = {0x00};
 
-    u8 round_key[16 * 17] = {0x00};
+    u8 round_key[ROUND_KEY_LEN] = {0x00};
 
     //! step1
+    R = kernel->key_setup(CBC_KEY, round_key, KEY_BIT);
     for (cnt_j = 0; cnt_j < LEN_SEED; cnt_j++)
     {
-        for (cnt_i = 0; cnt_i < DF_INPUT_LEN / 16; cnt_i++)
-        {
-            set_state(state, in, 16 * cnt_i);
-            XoR(state, chain_value, BLOCK_SIZE);
-            //!Function
-            Crypt(state, EncKeySetup(CBC_KEY, round_key, 128), round_key, chain_value);
-        }
+        //!Function
+        kernel->cbc_mac(round_key, R, chain_value, in, DF_INPUT_LEN / 16);
         copy_state(KEYandV, chain_value, cnt_j);
         clear(chain_value, BLOCK_SIZE);
         in[3]++;
     }
 
     //! step2
-    u8 key[16] = {0x00};
+    u8 key[KEY_SIZE] = {0x00};
     for (cnt_i = 0; cnt_i < KEY_SIZE; cnt_i++)
     {
         key[cnt_i] = KEYandV[cnt_i];
     }
     for (cnt_i = KEY_SIZE; cnt_i < SEED_LEN; cnt_i++)
     {
-        state[cnt_i] = KEYandV[cnt_i];
+        state[cnt_i - KEY_SIZE] = KEYandV[cnt_i];
     }
 
+    R = kernel->key_setup(key, round_key, KEY_BIT);
     for (cnt_i = 0; cnt_i < LEN_SEED; cnt_i++)
     {
         //!Function
-        Crypt(state, EncKeySetup(key, round_key, 128), round_key, chain_value);
+        kernel->ecb(round_key, R, state, chain_value, 1);
         for (cnt_j = 0; cnt_j < BLOCK_SIZE; cnt_j++)
         {
             seed[cnt_i * BLOCK_SIZE + cnt_j] = chain_value[cnt_j];
@@ -61,25 +68,14 @@ void derived_function(u8 *input_data, u8 *seed)
 
 void update_first_call(st_state *state, u8 *seed)
 {
-    volatile int cnt_i = 0, cnt_j = 0, cnt_k = 0;
-    u8 result[BLOCK_SIZE] = {0x00};
+    volatile int cnt_i = 0;
+    const st_kernel *kernel = Kernel();
     u8 temp[SEED_LEN] = {0x00};
+    u8 round_key[ROUND_KEY_LEN] = {0x00};
 
-    /*
-    * AVR function Setting
-    */
-    u8 round_key[(KEY_BIT / 8) * 17] = {0x00};
+    //! Function
+    kernel->ctr(round_key, kernel->key_setup(state->key, round_key, KEY_BIT), state->V, temp, LEN_SEED);
 
-    for (cnt_i = 0; cnt_i < LEN_SEED; cnt_i++)
-    {
-        state->V[BLOCK_SIZE - 1]++;
-        //! Function
-        Crypt(state->V, EncKeySetup(state->key, round_key, KEY_BIT), round_key, result);
-        for (cnt_j = 0; cnt_j < BLOCK_SIZE; cnt_j++)
-        {
-            temp[cnt_i * BLOCK_SIZE + cnt_j] = result[cnt_j];
-        }
-    }
     for (cnt_i = 0; cnt_i < KEY_SIZE; cnt_i++)
     {
         state->key[cnt_i] = temp[cnt_i] ^ seed[cnt_i];
@@ -91,25 +87,14 @@ void update_first_call(st_state *state, u8 *seed)
 }
 void update(st_state *state, u8 *seed, u8 *add_data)
 {
-    volatile int cnt_i = 0, cnt_j = 0, cnt_k = 0;
-    u8 result[BLOCK_SIZE] = {0x00};
+    volatile int cnt_i = 0;
+    const st_kernel *kernel = Kernel();
     u8 temp[SEED_LEN] = {0x00};
+    u8 round_key[ROUND_KEY_LEN] = {0x00};
 
-    /*
-    * AVR function Setting
-    */
-    u8 round_key[(KEY_BIT / 8) * 17] = {0x00};
+    //! Function
+    kernel->ctr(round_key, kernel->key_setup(state->key, round_key, KEY_BIT), state->V, temp, LEN_SEED);
 
-    for (cnt_i = 0; cnt_i < LEN_SEED; cnt_i++)
-    {
-        state->V[BLOCK_SIZE - 1]++;
-        //! Function
-        Crypt(state->V, EncKeySetup(state->key, round_key, KEY_BIT), round_key, result);
-        for (cnt_j = 0; cnt_j < BLOCK_SIZE; cnt_j++)
-        {
-            temp[cnt_i * BLOCK_SIZE + cnt_j] = result[cnt_j];
-        }
-    }
     for (cnt_i = 0; cnt_i < KEY_SIZE; cnt_i++)
     {
         state->key[cnt_i] = temp[cnt_i] ^ seed[cnt_i];
@@ -144,7 +129,12 @@ void generate_Random(st_state *state, u8 *random, u8 *re_add_data)
 
     if (state->prediction_flag == TRUE)
     {
-        Reseed_Function(state, re_add_data);
+        //! never output without the reseed
+        if (!Reseed_Prediction(state, re_add_data))
+        {
+            clear(random, RANDOM_LEN);
+            return;
+        }
         Output(state, random);
         copy_state_seed(seed, state);
         update_first_call(state, seed);
@@ -156,95 +146,197 @@ void generate_Random(st_state *state, u8 *random, u8 *re_add_data)
         update_first_call(state, seed);
     }
     state->Reseed_counter++;
+    state->Reseed_bytes += RANDOM_LEN;
+}
+
+/*
+*   Block_Cipher_df (SP 800-90A 10.3.2) of input || add to SEED_LEN bytes:
+*   BCC over IV_j || L || N || input || add || 0x80 || 0^* for each of the
+*   LEN_SEED chains, L the real input length, then the chain values as key
+*   and first block. FALSE if the message cannot be allocated.
+*/
+#define DF_STACK 256
+
+int Block_Cipher_df(const u8 *input, size_t len, const u8 *add, size_t add_len, u8 *seed)
+{
+    static const u8 CBC_KEY[32] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f};
+    const st_kernel *kernel = Kernel();
+    size_t total = len + add_len;
+    size_t msg_len = (BLOCK_SIZE + 8 + total + 1 + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+    u8 stack[DF_STACK];
+    u8 *msg = stack;
+    u8 round_key[ROUND_KEY_LEN];
+    u8 temp[SEED_LEN];
+    u8 chain[BLOCK_SIZE];
+    int R;
+
+    if (total < len || total > 0xffffffffUL)
+        return FALSE;
+    if (msg_len > DF_STACK && (msg = (u8 *)Secure_Alloc(msg_len, 0)) == NULL)
+        return FALSE;
+    memset(msg, 0, msg_len);
+    for (int cnt_i = 0; cnt_i < 4; cnt_i++)
+    {
+        msg[BLOCK_SIZE + cnt_i] = (u8)(total >> (24 - 8 * cnt_i));
+        msg[BLOCK_SIZE + 4 + cnt_i] = (u8)(SEED_LEN >> (24 - 8 * cnt_i));
+    }
+    if (len != 0)
+        memcpy(msg + BLOCK_SIZE + 8, input, len);
+    if (add_len != 0)
+        memcpy(msg + BLOCK_SIZE + 8 + len, add, add_len);
+    msg[BLOCK_SIZE + 8 + total] = 0x80;
+
+    R = kernel->key_setup(CBC_KEY, round_key, KEY_BIT);
+    for (int cnt_j = 0; cnt_j < LEN_SEED; cnt_j++)
+    {
+        msg[3] = (u8)cnt_j;
+        memset(chain, 0, BLOCK_SIZE);
+        kernel->cbc_mac(round_key, R, chain, msg, msg_len / BLOCK_SIZE);
+        memcpy(temp + cnt_j * BLOCK_SIZE, chain, BLOCK_SIZE);
+    }
+    R = kernel->key_setup(temp, round_key, KEY_BIT);
+    memcpy(chain, temp + KEY_SIZE, BLOCK_SIZE);
+    for (int cnt_j = 0; cnt_j < LEN_SEED; cnt_j++)
+    {
+        kernel->ecb(round_key, R, chain, seed + cnt_j * BLOCK_SIZE, 1);
+        memcpy(chain, seed + cnt_j * BLOCK_SIZE, BLOCK_SIZE);
+    }
+    if (msg == stack)
+        clear(msg, (int)msg_len);
+    else
+        Secure_Free(msg);
+    clear(round_key, ROUND_KEY_LEN);
+    clear(temp, SEED_LEN);
+    clear(chain, BLOCK_SIZE);
+    return TRUE;
+}
+
+/*
+*   Reseed (SP 800-90A 10.2.1.4.2): (Key, V) = Update(df(entropy || add),
+*   Key, V), counters reset. FALSE, state untouched, if the df failed.
+*/
+int Reseed_Input(st_state *state, const u8 *entropy, size_t entropy_len, const u8 *add, size_t add_len)
+{
+    u8 seed[SEED_LEN];
+
+    if (!Block_Cipher_df(entropy, entropy_len, add, add_len, seed))
+        return FALSE;
+    update_first_call(state, seed);
+    clear(seed, SEED_LEN);
+    state->Reseed_counter = 0;
+    state->Reseed_bytes = 0;
+    return TRUE;
 }
 
+//! reseed from RESEED_ADD_DATA_LEN bytes of entropy input
 void Reseed_Function(st_state *state, u8 *Reseed_AddData)
 {
     if (Reseed_AddData == NULL)
         return;
+    Reseed_Input(state, Reseed_AddData, RESEED_ADD_DATA_LEN, NULL, 0);
+}
 
-    volatile int cnt_i = 0, cnt_j = 0, cnt_k = 0;
-    u8 CBC_KEY[32] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f};
-    u8 chain_value[BLOCK_SIZE] = {0x00};
-    u8 KEYandV[LEN_SEED * BLOCK_SIZE] = {0x00};
-    u8 in[RESEED_INPUT_LEN] = {0x00};
+void Output(st_state *state, u8 *random)
+{
+    const st_kernel *kernel = Kernel();
+    u8 round_key[ROUND_KEY_LEN] = {0x00};
 
-    for (cnt_i = 0; cnt_i < RESEED_ADD_DATA_LEN; cnt_i++)
+    //! Function
+    kernel->ctr(round_key, kernel->key_setup(state->key, round_key, KEY_BIT), state->V, random, RANDOM_LEN / BLOCK_SIZE);
+}
+/*
+*   Variable length output: whole blocks go straight to random,
+*   only the last partial block goes through a temporary.
+*/
+void Output_Bytes(st_state *state, u8 *random, size_t len)
+{
+    const st_kernel *kernel = Kernel();
+    u8 round_key[ROUND_KEY_LEN] = {0x00};
+    u8 last[BLOCK_SIZE] = {0x00};
+    size_t blocks = len / BLOCK_SIZE;
+    int R = kernel->key_setup(state->key, round_key, KEY_BIT);
+
+    kernel->ctr(round_key, R, state->V, random, blocks);
+    if (len % BLOCK_SIZE != 0)
     {
-        in[cnt_i + 24] = Reseed_AddData[cnt_i];
+        kernel->ctr(round_key, R, state->V, last, 1);
+        memcpy(random + blocks * BLOCK_SIZE, last, len % BLOCK_SIZE);
+        clear(last, BLOCK_SIZE);
     }
-    in[cnt_i] = N_CONSTANT;
-    in[19] = RESEED_ADD_DATA_LEN;
-    in[23] = N_DF;
-    in[24 + RESEED_ADD_DATA_LEN] = 0x80;
+}
 
-    u8 state2[BLOCK_SIZE] = {0x00};
-    /*
-    * AVR function Setting
-    */
-    u8 round_key[16 * 17] = {0x00};
+//! Output + update_first_call of generate_Random, sharing one key expansion
+static void generate_request(st_state *state, u8 *random, size_t len)
+{
+    const st_kernel *kernel = Kernel();
+    u8 round_key[ROUND_KEY_LEN] = {0x00};
+    u8 last[BLOCK_SIZE] = {0x00};
+    u8 seed[SEED_LEN] = {0x00};
+    u8 temp[SEED_LEN] = {0x00};
+    size_t blocks = len / BLOCK_SIZE;
+    int R = kernel->key_setup(state->key, round_key, KEY_BIT);
 
-    //! step1
-    for (cnt_j = 0; cnt_j < LEN_SEED; cnt_j++)
+    kernel->ctr(round_key, R, state->V, random, blocks);
+    if (len % BLOCK_SIZE != 0)
     {
-        for (cnt_i = 0; cnt_i < RESEED_INPUT_LEN / 16; cnt_i++)
-        {
-            set_state(state2, in, 16 * cnt_i);
-            XoR(state2, chain_value, BLOCK_SIZE);
-            //!Function
-            Crypt(state2, EncKeySetup(CBC_KEY, round_key, 128), round_key, chain_value);
-        }
-        copy_state(KEYandV, chain_value, cnt_j);
-        clear(chain_value, BLOCK_SIZE);
-        in[3]++;
+        kernel->ctr(round_key, R, state->V, last, 1);
+        memcpy(random + blocks * BLOCK_SIZE, last, len % BLOCK_SIZE);
+        clear(last, BLOCK_SIZE);
     }
 
-    //! step2
-    u8 key[16] = {0x00};
-    for (cnt_i = 0; cnt_i < KEY_SIZE; cnt_i++)
+    copy_state_seed(seed, state);
+    kernel->ctr(round_key, R, state->V, temp, LEN_SEED);
+    for (int cnt_i = 0; cnt_i < KEY_SIZE; cnt_i++)
     {
-        key[cnt_i] = KEYandV[cnt_i];
+        state->key[cnt_i] = temp[cnt_i] ^ seed[cnt_i];
     }
-    for (cnt_i = KEY_SIZE; cnt_i < SEED_LEN; cnt_i++)
+    for (int cnt_i = 0; cnt_i < BLOCK_SIZE; cnt_i++)
     {
-        state2[cnt_i] = KEYandV[cnt_i];
+        state->V[cnt_i] = temp[KEY_SIZE + cnt_i] ^ seed[KEY_SIZE + cnt_i];
     }
+    clear(seed, SEED_LEN);
+    clear(temp, SEED_LEN);
+}
 
-    u8 temp[SEED_LEN] = {0x00};
-    for (cnt_i = 0; cnt_i < LEN_SEED; cnt_i++)
+/*
+*   generate_Random for any length. Requests longer than MAX_REQUEST_LEN
+*   are served as several requests, each followed by its own update.
+*   FALSE if a reseed was due (or prediction resistance is on) and no
+*   entropy could be read; the remaining output is not generated.
+*/
+int generate_Bytes(st_state *state, u8 *random, size_t len, u8 *re_add_data)
+{
+    do
     {
-        //!Function
-        Crypt(state2, EncKeySetup(key, round_key, 128), round_key, chain_value);
-        for (cnt_j = 0; cnt_j < BLOCK_SIZE; cnt_j++)
-        {
-            temp[cnt_i * BLOCK_SIZE + cnt_j] = chain_value[cnt_j];
-            state2[cnt_j] = chain_value[cnt_j];
-        }
-    }
-    update_first_call(state, temp);
+        size_t n = len < MAX_REQUEST_LEN ? len : MAX_REQUEST_LEN;
+
+        if (!Reseed_Check(state, n))
+            return FALSE;
+        if (state->prediction_flag == TRUE && !Reseed_Prediction(state, re_add_data))
+            return FALSE;
+        generate_request(state, random, n);
+        state->Reseed_counter++;
+        state->Reseed_bytes += n;
+        //! additional input belongs to the request, not to each part of it
+        re_add_data = NULL;
+        random += n;
+        len -= n;
+    } while (len > 0);
+    return TRUE;
 }
 
-void Output(st_state *state, u8 *random)
+//! fresh instance from INSTANCE_INPUT bytes of entropy || nonce || personalization
+void Instantiate(st_state *state, u8 *in)
 {
-    volatile int cnt_i = 0, cnt_j = 0, cnt_k = 0;
-    u8 result[BLOCK_SIZE] = {0x00};
-
-    /*
-    * AVR function Setting
-    */
-    u8 round_key[(KEY_BIT / 8) * 17] = {0x00};
+    u8 seed[SEED_LEN] = {0x00};
 
-    for (cnt_i = 0; cnt_i < (RANDOM_LEN / BLOCK_SIZE); cnt_i++)
-    {
-        state->V[BLOCK_SIZE - 1]++;
-        //! Function
-        Crypt(state->V, EncKeySetup(state->key, round_key, KEY_BIT), round_key, result);
-        for (cnt_j = 0; cnt_j < BLOCK_SIZE; cnt_j++)
-        {
-            random[cnt_i * BLOCK_SIZE + cnt_j] = result[cnt_j];
-        }
-    }
+    clear((u8 *)state, sizeof(st_state));
+    derived_function(in, seed);
+    update_first_call(state, seed);
+    state->fork_gen = Fork_Generation();
+    clear(seed, SEED_LEN);
 }
+
 void CTR_DRBG(st_state *in_state, u8 *in, u8 *seed, u8 *random, u8 *re_add_data)
 {
     derived_function(in, seed);
@@ -268,21 +360,12 @@ void set_state(u8 *drc, u8 *src, int start)
 }
 void copy_state(u8 *drc, u8 *src, int len)
 {
-    for (volatile int cnt_i = 0; cnt_i < BLOCK_SIZE; cnt_i++)
-    {
-        drc[16 * len + cnt_i] = src[cnt_i];
-    }
+    memcpy(drc + 16 * len, src, BLOCK_SIZE);
 }
 void copy_state_seed(u8 *drc, st_state *src)
 {
-    for (volatile int cnt_i = 0; cnt_i < KEY_SIZE; cnt_i++)
-    {
-        drc[cnt_i] = src->key[cnt_i];
-    }
-    for (volatile int cnt_i = 0; cnt_i < BLOCK_SIZE; cnt_i++)
-    {
-        drc[KEY_SIZE + cnt_i] = src->V[cnt_i];
-    }
+    memcpy(drc, src->key, KEY_SIZE);
+    memcpy(drc + KEY_SIZE, src->V, BLOCK_SIZE);
 }
 void copy(u8 *drc, u8 *src)
 {
@@ -291,12 +374,11 @@ void copy(u8 *drc, u8 *src)
         drc[cnt_i] = src[cnt_i];
     }
 }
+//! the empty asm keeps the memset from being dropped as a dead store
 void clear(u8 *src, int len)
 {
-    for (volatile int cnt_i = 0; cnt_i < len; cnt_i++)
-    {
-        src[cnt_i] = 0x00;
-    }
+    memset(src, 0, (size_t)len);
+    __asm__ volatile("" : : "r"(src) : "memory");
 }
 void Show_State(st_state *state)
 {
@@ -0,0 +1,184 @@
+#include "header.h"
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HEALTH_X86
+#endif
+
+/*
+*   SP 800-90B continuous health tests (4.4.1 RCT, 4.4.2 APT)
+*
+*   Cutoffs follow from the claimed min-entropy h and alpha = 2^-HEALTH_ALPHA:
+*   RCT C = 1 + ceil(HEALTH_ALPHA / h), APT C = 1 + CRITBINOM(W, 2^-h, 1 - alpha).
+*   The AVX2 path compares 32 samples per step: RCT looks for C - 1 set bits
+*   in a row in the mask of x[i] == x[i - 1], APT pop-counts the mask of
+*   x[i] == A. Both keep the same state as the byte loop, so a buffer may be
+*   split anywhere.
+*/
+static void (*CALLBACK)(const char *name, int test, void *arg) = NULL;
+static void *CALLBACK_ARG = NULL;
+static int VECTOR = FALSE; // probed by Health_Init, cpuid is slow under a hypervisor
+
+void Health_Callback(void (*callback)(const char *name, int test, void *arg), void *arg)
+{
+    CALLBACK = callback;
+    CALLBACK_ARG = arg;
+}
+
+//! smallest k with P(X > k) <= 2^-HEALTH_ALPHA, X ~ B(n, p)
+static unsigned int critbinom(unsigned int n, double p)
+{
+    double pmf[HEALTH_WINDOW + 1], tail = 0.0;
+    double alpha = ldexp(1.0, -HEALTH_ALPHA);
+    unsigned int k;
+
+    pmf[0] = pow(1.0 - p, (double)n);
+    for (k = 0; k < n; k++)
+    {
+        pmf[k + 1] = pmf[k] * (double)(n - k) / (double)(k + 1) * p / (1.0 - p);
+    }
+    for (k = n; k > 0; k--)
+    {
+        if (tail + pmf[k] > alpha)
+            break;
+        tail += pmf[k];
+    }
+    return k;
+}
+
+//! h is clamped to [0.5, 8], below that the APT window needs the binary variant
+void Health_Init(st_health *health, double h)
+{
+    memset(health, 0, sizeof(st_health));
+#if defined(HEALTH_X86)
+    VECTOR = (CPU_Features() & CPU_AVX2) != 0;
+#endif
+    if (h < 0.5)
+        h = 0.5;
+    if (h > 8.0)
+        h = 8.0;
+    health->h = h;
+    health->rct_cutoff = 1 + (unsigned int)ceil(HEALTH_ALPHA / h);
+    health->apt_cutoff = 1 + critbinom(HEALTH_WINDOW, pow(2.0, -h));
+}
+
+static int health_fail(st_health *health, const char *name, int test)
+{
+    health->failed = TRUE;
+    if (CALLBACK != NULL)
+        CALLBACK(name, test, CALLBACK_ARG);
+    return FALSE;
+}
+
+//! one sample, reference for the vector paths
+static int health_byte(st_health *health, u8 b)
+{
+    if (health->samples++ != 0 && b == health->rct_value)
+    {
+        if (++health->rct_run >= health->rct_cutoff)
+            return HEALTH_RCT;
+    }
+    else
+    {
+        health->rct_value = b;
+        health->rct_run = 1;
+    }
+
+    if (health->apt_pos == 0)
+    {
+        health->apt_value = b;
+        health->apt_count = 1;
+    }
+    else if (b == health->apt_value && ++health->apt_count >= health->apt_cutoff)
+    {
+        return HEALTH_APT;
+    }
+    health->apt_pos = (health->apt_pos + 1) % HEALTH_WINDOW;
+    return 0;
+}
+
+#if defined(HEALTH_X86)
+/*
+*   x[0 .. len) with len a multiple of 32, x[-1] readable, and the RCT state
+*   describing x[-1]. The APT window must not end inside the buffer.
+*/
+static __attribute__((target("avx2,popcnt,lzcnt,bmi"))) int health_avx2(st_health *health, const u8 *x, size_t len)
+{
+    __m256i a = _mm256_set1_epi8((char)health->apt_value);
+    unsigned int C = health->rct_cutoff - 1; // equal neighbours that fail
+    unsigned int run = health->rct_run - 1;
+
+    for (size_t cnt_i = 0; cnt_i < len; cnt_i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(x + cnt_i));
+        __m256i p = _mm256_loadu_si256((const __m256i *)(x + cnt_i - 1));
+        unsigned int m = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, p));
+
+        if (m == 0xffffffffu)
+        {
+            run += 32;
+        }
+        else
+        {
+            if (run + _tzcnt_u32(~m) >= C)
+                return HEALTH_RCT;
+            //! bit j of y: C set bits from j up
+            if (C <= 32)
+            {
+                unsigned int y = m;
+
+                for (unsigned int cnt_j = 1; cnt_j < C && y != 0; cnt_j++)
+                    y &= m >> cnt_j;
+                if (y != 0)
+                    return HEALTH_RCT;
+            }
+            run = _lzcnt_u32(~m);
+        }
+        if (run >= C)
+            return HEALTH_RCT;
+
+        health->apt_count += (unsigned int)_mm_popcnt_u32((unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, a)));
+        if (health->apt_count >= health->apt_cutoff)
+            return HEALTH_APT;
+    }
+    health->rct_value = x[len - 1];
+    health->rct_run = run + 1;
+    health->apt_pos = (health->apt_pos + (unsigned int)len) % HEALTH_WINDOW;
+    health->samples += len;
+    return 0;
+}
+#endif
+
+//! TRUE if x passes (and the source has not failed before)
+int Health_Test(st_health *health, const char *name, const u8 *x, size_t len)
+{
+    size_t cnt_i = 0;
+    int fail = 0;
+
+    if (health->failed)
+        return FALSE;
+
+    while (cnt_i < len && fail == 0)
+    {
+#if defined(HEALTH_X86)
+        //! vector steps need x[cnt_i - 1] and a window already started
+        if (VECTOR && cnt_i > 0 && health->apt_pos != 0 && len - cnt_i >= 32)
+        {
+            size_t n = (len - cnt_i) & ~(size_t)31;
+            size_t left = HEALTH_WINDOW - health->apt_pos;
+
+            if (n > left)
+                n = left & ~(size_t)31;
+            if (n != 0)
+            {
+                fail = health_avx2(health, x + cnt_i, n);
+                cnt_i += n;
+                continue;
+            }
+        }
+#endif
+        fail = health_byte(health, x[cnt_i++]);
+    }
+    return fail == 0 ? TRUE : health_fail(health, name, fail);
+}
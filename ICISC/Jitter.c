@@ -0,0 +1,144 @@
+#include "header.h"
+#include <pthread.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define JITTER_X86
+#endif
+
+/*
+*   CPU jitter entropy source
+*
+*   A sample is the time one round of JITTER_ACCESSES dependent
+*   read-modify-writes over a JITTER_MEM buffer takes; cache and TLB misses,
+*   frequency changes and interrupts make it vary. Only the time stamps are
+*   taken inside the timed loop. The deltas are folded to one byte each in
+*   a second pass that the compiler vectorizes, then the bytes go through
+*   the health tests (at JITTER_H bits per sample) and the conditioner, at
+*   JITTER_RATIO samples per output byte.
+*/
+#define JITTER_SAMPLES (JITTER_RATIO * CONDITION_OUT)
+
+typedef struct _ENTROPY_JITTER {
+    st_entropy base;
+    pthread_mutex_t lock;
+    st_conditioner *cond;
+    u8 *mem;
+    size_t idx;
+    unsigned long long stamp[JITTER_SAMPLES + 1];
+    u8 sample[JITTER_SAMPLES];
+    u8 out[CONDITION_OUT];
+    size_t pos; // CONDITION_OUT when empty
+} st_entropy_jitter;
+
+static inline unsigned long long jitter_stamp(void)
+{
+#if defined(JITTER_X86)
+    return __rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+#endif
+}
+
+//! JITTER_SAMPLES folded deltas into jitter->sample
+static void jitter_collect(st_entropy_jitter *jitter)
+{
+    u8 *mem = jitter->mem;
+    size_t idx = jitter->idx;
+
+    jitter->stamp[0] = jitter_stamp();
+    for (int cnt_i = 1; cnt_i <= JITTER_SAMPLES; cnt_i++)
+    {
+        //! each address depends on the byte read before, no prefetch
+        for (int cnt_j = 0; cnt_j < JITTER_ACCESSES; cnt_j++)
+        {
+            idx = (idx + mem[idx] * 64 + 4093) & (JITTER_MEM - 1);
+            mem[idx]++;
+        }
+        jitter->stamp[cnt_i] = jitter_stamp();
+    }
+    jitter->idx = idx;
+
+    for (int cnt_i = 0; cnt_i < JITTER_SAMPLES; cnt_i++)
+    {
+        unsigned long long d = jitter->stamp[cnt_i + 1] - jitter->stamp[cnt_i];
+
+        d ^= d >> 32;
+        d ^= d >> 16;
+        d ^= d >> 8;
+        jitter->sample[cnt_i] = (u8)d;
+    }
+}
+
+static int jitter_read(st_entropy *src, u8 *out, size_t len)
+{
+    st_entropy_jitter *jitter = (st_entropy_jitter *)src;
+    int ret = TRUE;
+
+    pthread_mutex_lock(&jitter->lock);
+    while (len > 0)
+    {
+        size_t n;
+
+        if (jitter->pos == CONDITION_OUT)
+        {
+            jitter_collect(jitter);
+            if (!Health_Test(&src->health, src->name, jitter->sample, JITTER_SAMPLES))
+            {
+                ret = FALSE;
+                break;
+            }
+            Condition_Feed(jitter->cond, jitter->sample, JITTER_SAMPLES, jitter->out);
+            jitter->pos = 0;
+        }
+        n = CONDITION_OUT - jitter->pos < len ? CONDITION_OUT - jitter->pos : len;
+        memcpy(out, jitter->out + jitter->pos, n);
+        memset(jitter->out + jitter->pos, 0, n);
+        jitter->pos += n;
+        out += n;
+        len -= n;
+    }
+    clear(jitter->sample, JITTER_SAMPLES);
+    clear((u8 *)jitter->stamp, sizeof(jitter->stamp));
+    pthread_mutex_unlock(&jitter->lock);
+    return ret;
+}
+
+static void jitter_release(st_entropy *src)
+{
+    st_entropy_jitter *jitter = (st_entropy_jitter *)src;
+
+    pthread_mutex_destroy(&jitter->lock);
+    Condition_Free(jitter->cond);
+    free(jitter->mem);
+    clear((u8 *)jitter, sizeof(st_entropy_jitter));
+    free(jitter);
+}
+
+st_entropy *Entropy_Jitter_New(void)
+{
+    st_entropy_jitter *jitter = (st_entropy_jitter *)calloc(1, sizeof(st_entropy_jitter));
+
+    if (jitter == NULL)
+        return NULL;
+    jitter->mem = (u8 *)calloc(JITTER_MEM, 1);
+    jitter->cond = Condition_New(JITTER_RATIO);
+    if (jitter->mem == NULL || jitter->cond == NULL)
+    {
+        Condition_Free(jitter->cond);
+        free(jitter->mem);
+        free(jitter);
+        return NULL;
+    }
+    jitter->base.name = "jitter";
+    jitter->base.read = jitter_read;
+    jitter->base.release = jitter_release;
+    Health_Init(&jitter->base.health, JITTER_H);
+    pthread_mutex_init(&jitter->lock, NULL);
+    jitter->pos = CONDITION_OUT;
+    return &jitter->base;
+}
@@ -0,0 +1,482 @@
+#include "header.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#define KERNEL_X86
+#endif
+
+extern const u8 S[4][256];
+extern const u8 KRK[3][16];
+
+/*
+*   CPU feature probe
+*/
+#if defined(KERNEL_X86)
+static unsigned long long xgetbv0(void)
+{
+    unsigned int eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((unsigned long long)edx << 32) | eax;
+}
+#endif
+
+unsigned int CPU_Features(void)
+{
+    unsigned int features = 0;
+#if defined(KERNEL_X86)
+    unsigned int eax, ebx, ecx, edx;
+    unsigned long long xcr0 = 0;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return 0;
+    if (edx & (1u << 26))
+        features |= CPU_SSE2;
+    if (ecx & (1u << 9))
+        features |= CPU_SSSE3;
+    if (ecx & (1u << 25))
+        features |= CPU_AESNI;
+    if (ecx & (1u << 27)) //OSXSAVE
+        xcr0 = xgetbv0();
+
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+        return features;
+    //! wide kernels need the OS to save YMM (and ZMM) state
+    if ((xcr0 & 0x06) == 0x06)
+    {
+        if (ebx & (1u << 5))
+            features |= CPU_AVX2;
+        if (ecx & (1u << 8))
+            features |= CPU_GFNI;
+        if (ecx & (1u << 9))
+            features |= CPU_VAES;
+    }
+    if ((xcr0 & 0xE6) == 0xE6 && (ebx & (1u << 16)) && (ebx & (1u << 30)) && (ebx & (1u << 31)))
+        features |= CPU_AVX512;
+#endif
+    return features;
+}
+
+//! family / model / stepping, 0 when unknown
+unsigned int CPU_Signature(void)
+{
+#if defined(KERNEL_X86)
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return eax;
+#endif
+    return 0;
+}
+
+/*
+*   Counter helper
+*   V is a big-endian BLOCK_BIT counter, V = (V + n) mod 2^BLOCK_BIT
+*/
+void Counter_Add(u8 *V, size_t n)
+{
+    unsigned long long carry = n;
+    for (int cnt_i = BLOCK_SIZE - 1; cnt_i >= 0 && carry != 0; cnt_i--)
+    {
+        carry += V[cnt_i];
+        V[cnt_i] = (u8)carry;
+        carry >>= 8;
+    }
+}
+
+/*
+*   ARIA key schedule with the 128-bit rotations done on two 64-bit words
+*   instead of byte by byte. Output is identical to EncKeySetup.
+*/
+static void load_w64(const u8 *s, unsigned long long *hi, unsigned long long *lo)
+{
+    memcpy(hi, s, 8);
+    memcpy(lo, s + 8, 8);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    *hi = __builtin_bswap64(*hi);
+    *lo = __builtin_bswap64(*lo);
+#endif
+}
+
+static void store_w64(u8 *t, unsigned long long hi, unsigned long long lo)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    hi = __builtin_bswap64(hi);
+    lo = __builtin_bswap64(lo);
+#endif
+    memcpy(t, &hi, 8);
+    memcpy(t + 8, &lo, 8);
+}
+
+static void RotXOR_W64(const u8 *s, int n, u8 *t)
+{
+    unsigned long long hi, lo, r_hi, r_lo, t_hi, t_lo;
+
+    load_w64(s, &hi, &lo);
+    if (n >= 64)
+    {
+        unsigned long long tmp = hi;
+        hi = lo;
+        lo = tmp;
+        n -= 64;
+    }
+    r_hi = hi;
+    r_lo = lo;
+    if (n != 0)
+    {
+        r_hi = (hi >> n) | (lo << (64 - n));
+        r_lo = (lo >> n) | (hi << (64 - n));
+    }
+    load_w64(t, &t_hi, &t_lo);
+    store_w64(t, t_hi ^ r_hi, t_lo ^ r_lo);
+}
+
+int EncKeySetup_W64(const u8 *w0, u8 *e, int keyBits)
+{
+    int i, R = (keyBits + 256) / 32, q;
+    u8 t[16], w1[16], w2[16], w3[16];
+    static const int rot[5] = {19, 31, 67, 97, 109};
+    const u8 *w[4] = {w0, w1, w2, w3};
+
+    q = (keyBits - 128) / 64;
+    for (i = 0; i < 16; i++)
+        t[i] = S[i % 4][KRK[q][i] ^ w0[i]];
+    DL(t, w1);
+    if (R == 14)
+        for (i = 0; i < 8; i++)
+            w1[i] ^= w0[16 + i];
+    else if (R == 16)
+        for (i = 0; i < 16; i++)
+            w1[i] ^= w0[16 + i];
+
+    q = (q == 2) ? 0 : (q + 1);
+    for (i = 0; i < 16; i++)
+        t[i] = S[(2 + i) % 4][KRK[q][i] ^ w1[i]];
+    DL(t, w2);
+    for (i = 0; i < 16; i++)
+        w2[i] ^= w0[i];
+
+    q = (q == 2) ? 0 : (q + 1);
+    for (i = 0; i < 16; i++)
+        t[i] = S[i % 4][KRK[q][i] ^ w2[i]];
+    DL(t, w3);
+    for (i = 0; i < 16; i++)
+        w3[i] ^= w1[i];
+
+    //! e[k] = W[k % 4] ^ (W[(k + 1) % 4] >>> rot[k / 4])
+    for (i = 0; i <= R; i++)
+    {
+        memcpy(e + 16 * i, w[i % 4], 16);
+        RotXOR_W64(w[(i + 1) % 4], rot[i / 4], e + 16 * i);
+    }
+    return R;
+}
+
+/*
+*   Key schedules of many keys at once: the three F-rounds of each step run
+*   on all keys through the kernel's f_round, the rotations stay scalar.
+*   Output is identical to EncKeySetup.
+*/
+int EncKeySetup_Batch(const u8 *const *w0, u8 *const *e, int count, int keyBits)
+{
+    const st_kernel *kernel = Kernel();
+    int R = (keyBits + 256) / 32;
+    u8 w[4][BATCH_STATES][16];
+    static const int rot[5] = {19, 31, 67, 97, 109};
+
+    for (int base = 0; base < count; base += BATCH_STATES)
+    {
+        int n = count - base < BATCH_STATES ? count - base : BATCH_STATES;
+        int q = (keyBits - 128) / 64;
+
+        for (int cnt_i = 0; cnt_i < n; cnt_i++)
+        {
+            memcpy(w[0][cnt_i], w0[base + cnt_i], 16);
+        }
+        memcpy(w[1], w[0], sizeof(w[0]));
+        kernel->f_round(KRK[q], 0, w[1][0], n);
+        for (int cnt_i = 0; cnt_i < n && R > 12; cnt_i++)
+        {
+            for (int cnt_j = 0; cnt_j < (R == 14 ? 8 : 16); cnt_j++)
+                w[1][cnt_i][cnt_j] ^= w0[base + cnt_i][16 + cnt_j];
+        }
+
+        q = (q == 2) ? 0 : (q + 1);
+        memcpy(w[2], w[1], sizeof(w[1]));
+        kernel->f_round(KRK[q], 1, w[2][0], n);
+        for (int cnt_i = 0; cnt_i < n; cnt_i++)
+        {
+            for (int cnt_j = 0; cnt_j < 16; cnt_j++)
+                w[2][cnt_i][cnt_j] ^= w[0][cnt_i][cnt_j];
+        }
+
+        q = (q == 2) ? 0 : (q + 1);
+        memcpy(w[3], w[2], sizeof(w[2]));
+        kernel->f_round(KRK[q], 0, w[3][0], n);
+        for (int cnt_i = 0; cnt_i < n; cnt_i++)
+        {
+            for (int cnt_j = 0; cnt_j < 16; cnt_j++)
+                w[3][cnt_i][cnt_j] ^= w[1][cnt_i][cnt_j];
+        }
+
+        for (int cnt_i = 0; cnt_i < n; cnt_i++)
+        {
+            u8 *rk = e[base + cnt_i];
+
+            for (int k = 0; k <= R; k++)
+            {
+                memcpy(rk + 16 * k, w[k % 4][cnt_i], 16);
+                RotXOR_W64(w[(k + 1) % 4][cnt_i], rot[k / 4], rk + 16 * k);
+            }
+        }
+        for (int k = 0; k < 4; k++)
+            clear(w[k][0], 16 * n);
+    }
+    return R;
+}
+
+/*
+*   Reference kernel: the original Crypt, one block at a time,
+*   with the round keys expanded once per call instead of once per block.
+*/
+static void ref_ecb(const u8 *round_key, int R, const u8 *in, u8 *out, size_t blocks)
+{
+    for (size_t cnt_i = 0; cnt_i < blocks; cnt_i++)
+    {
+        Crypt(in + BLOCK_SIZE * cnt_i, R, round_key, out + BLOCK_SIZE * cnt_i);
+    }
+}
+
+static void ref_ecb_keys(const u8 *const *round_key, int R, const u8 *in, u8 *out, size_t blocks)
+{
+    for (size_t cnt_i = 0; cnt_i < blocks; cnt_i++)
+    {
+        Crypt(in + BLOCK_SIZE * cnt_i, R, round_key[cnt_i], out + BLOCK_SIZE * cnt_i);
+    }
+}
+
+static void ref_ctr(const u8 *round_key, int R, u8 *V, u8 *out, size_t blocks)
+{
+    for (size_t cnt_i = 0; cnt_i < blocks; cnt_i++)
+    {
+        Counter_Add(V, 1);
+        Crypt(V, R, round_key, out + BLOCK_SIZE * cnt_i);
+    }
+}
+
+static void ref_cbc_mac(const u8 *round_key, int R, u8 *chain, const u8 *in, size_t blocks)
+{
+    u8 state[BLOCK_SIZE];
+
+    for (size_t cnt_i = 0; cnt_i < blocks; cnt_i++)
+    {
+        for (int cnt_j = 0; cnt_j < BLOCK_SIZE; cnt_j++)
+        {
+            state[cnt_j] = in[BLOCK_SIZE * cnt_i + cnt_j] ^ chain[cnt_j];
+        }
+        Crypt(state, R, round_key, chain);
+    }
+}
+
+static void ref_cbc_mac_chains(const u8 *round_key, int R, u8 *chain, const u8 *const *in, size_t chains, size_t blocks)
+{
+    for (size_t cnt_i = 0; cnt_i < chains; cnt_i++)
+    {
+        ref_cbc_mac(round_key, R, chain + BLOCK_SIZE * cnt_i, in[cnt_i], blocks);
+    }
+}
+
+static void ref_f_round(const u8 *ck, int p, u8 *x, size_t blocks)
+{
+    u8 t[BLOCK_SIZE];
+
+    for (size_t cnt_i = 0; cnt_i < blocks; cnt_i++)
+    {
+        for (int cnt_j = 0; cnt_j < BLOCK_SIZE; cnt_j++)
+        {
+            t[cnt_j] = S[(cnt_j + 2 * p) % 4][ck[cnt_j] ^ x[BLOCK_SIZE * cnt_i + cnt_j]];
+        }
+        DL(t, x + BLOCK_SIZE * cnt_i);
+    }
+}
+
+static const st_kernel KERNEL_ARIA_REF = {
+    "aria_ref", 0, EncKeySetup, ref_ecb, ref_ecb_keys, ref_ctr, ref_cbc_mac, ref_cbc_mac_chains, ref_f_round};
+
+static const st_kernel KERNEL_ARIA_W64 = {
+    "aria_w64", 0, EncKeySetup_W64, ref_ecb, ref_ecb_keys, ref_ctr, ref_cbc_mac, ref_cbc_mac_chains, ref_f_round};
+
+//! fastest first, the reference kernel must stay last
+const st_kernel *KERNEL_TABLE[] = {
+#if defined(KERNEL_X86)
+    &KERNEL_ARIA_GFNI512,
+    &KERNEL_ARIA_GFNI,
+    &KERNEL_ARIA_VAES,
+    &KERNEL_ARIA_AESNI,
+#endif
+    &KERNEL_ARIA_W64,
+    &KERNEL_ARIA_REF,
+    NULL};
+
+/*
+*   Known-answer test
+*   RFC 5794 ARIA-128 vector, then every entry point and the key schedule
+*   against the reference kernel for every key size.
+*/
+#define CHECK_BLOCKS 37
+
+static pthread_once_t TABLES_ONCE = PTHREAD_ONCE_INIT;
+
+int Kernel_Check(const st_kernel *kernel)
+{
+    static const u8 kat_key[16] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+    static const u8 kat_pt[16] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff};
+    static const u8 kat_ct[16] = {0xd7, 0x18, 0xfb, 0xd6, 0xab, 0x64, 0x4c, 0x73, 0x9d, 0xa9, 0x5f, 0x3b, 0xe6, 0x45, 0x17, 0x78};
+    u8 key[32], key2[32], rk[ROUND_KEY_LEN], rk_ref[ROUND_KEY_LEN], rk2[ROUND_KEY_LEN];
+    const u8 *keys[CHECK_BLOCKS], *msgs[CHECK_BLOCKS];
+    u8 chains[CHECK_BLOCKS * BLOCK_SIZE], chains_ref[CHECK_BLOCKS * BLOCK_SIZE];
+    u8 in[CHECK_BLOCKS * BLOCK_SIZE], out[CHECK_BLOCKS * BLOCK_SIZE], ref[CHECK_BLOCKS * BLOCK_SIZE];
+    u8 V[BLOCK_SIZE], V_ref[BLOCK_SIZE], chain[BLOCK_SIZE], chain_ref[BLOCK_SIZE];
+    int R, keyBits;
+
+    if ((kernel->features & CPU_Features()) != kernel->features)
+        return FALSE;
+#if defined(KERNEL_X86)
+    pthread_once(&TABLES_ONCE, Kernel_SIMD_Init);
+#endif
+
+    R = kernel->key_setup(kat_key, rk, 128);
+    kernel->ecb(rk, R, kat_pt, out, 1);
+    if (memcmp(out, kat_ct, BLOCK_SIZE) != 0)
+        return FALSE;
+
+    for (int cnt_i = 0; cnt_i < (int)sizeof(in); cnt_i++)
+        in[cnt_i] = (u8)(cnt_i * 7 + 1);
+    for (int cnt_i = 0; cnt_i < (int)sizeof(key); cnt_i++)
+        key[cnt_i] = (u8)(0xA5 ^ (cnt_i * 13));
+
+    for (keyBits = 128; keyBits <= 256; keyBits += 64)
+    {
+        memset(rk, 0, sizeof(rk));
+        memset(rk_ref, 0, sizeof(rk_ref));
+        R = kernel->key_setup(key, rk, keyBits);
+        if (R != EncKeySetup(key, rk_ref, keyBits) || memcmp(rk, rk_ref, 16 * (R + 1)) != 0)
+            return FALSE;
+        //! second schedule for ecb_keys: the key reversed
+        for (int cnt_i = 0; cnt_i < (int)sizeof(key); cnt_i++)
+            key2[cnt_i] = key[sizeof(key) - 1 - cnt_i];
+        kernel->key_setup(key2, rk2, keyBits);
+        for (int cnt_i = 0; cnt_i < CHECK_BLOCKS; cnt_i++)
+            keys[cnt_i] = cnt_i % 3 == 1 ? rk2 : rk;
+
+        for (size_t blocks = 1; blocks <= CHECK_BLOCKS; blocks += 6)
+        {
+            kernel->ecb(rk, R, in, out, blocks);
+            ref_ecb(rk, R, in, ref, blocks);
+            if (memcmp(out, ref, blocks * BLOCK_SIZE) != 0)
+                return FALSE;
+
+            kernel->ecb_keys(keys, R, in, out, blocks);
+            ref_ecb_keys(keys, R, in, ref, blocks);
+            if (memcmp(out, ref, blocks * BLOCK_SIZE) != 0)
+                return FALSE;
+
+            //! counter starts just below a byte carry
+            memset(V, 0xff, BLOCK_SIZE);
+            V[0] = 0x12;
+            V[BLOCK_SIZE - 1] = 0xfb;
+            memcpy(V_ref, V, BLOCK_SIZE);
+            kernel->ctr(rk, R, V, out, blocks);
+            ref_ctr(rk, R, V_ref, ref, blocks);
+            if (memcmp(out, ref, blocks * BLOCK_SIZE) != 0 || memcmp(V, V_ref, BLOCK_SIZE) != 0)
+                return FALSE;
+
+            memcpy(chain, in, BLOCK_SIZE);
+            memcpy(chain_ref, in, BLOCK_SIZE);
+            kernel->cbc_mac(rk, R, chain, in, blocks);
+            ref_cbc_mac(rk, R, chain_ref, in, blocks);
+            if (memcmp(chain, chain_ref, BLOCK_SIZE) != 0)
+                return FALSE;
+
+            //! 3-block messages at overlapping offsets of in
+            for (int cnt_i = 0; cnt_i < CHECK_BLOCKS; cnt_i++)
+                msgs[cnt_i] = in + BLOCK_SIZE * (cnt_i % (CHECK_BLOCKS - 3));
+            memcpy(chains, in, sizeof(chains));
+            memcpy(chains_ref, in, sizeof(chains_ref));
+            kernel->cbc_mac_chains(rk, R, chains, msgs, blocks, 3);
+            ref_cbc_mac_chains(rk, R, chains_ref, msgs, blocks, 3);
+            if (memcmp(chains, chains_ref, blocks * BLOCK_SIZE) != 0)
+                return FALSE;
+
+            for (int p = 0; p < 2; p++)
+            {
+                memcpy(out, in, blocks * BLOCK_SIZE);
+                memcpy(ref, in, blocks * BLOCK_SIZE);
+                kernel->f_round(key2, p, out, blocks);
+                ref_f_round(key2, p, ref, blocks);
+                if (memcmp(out, ref, blocks * BLOCK_SIZE) != 0)
+                    return FALSE;
+            }
+        }
+    }
+    return TRUE;
+}
+
+/*
+*   Binding
+*   KERNEL_BOUND is published with release and read with acquire, so a
+*   thread that sees a kernel also sees the tables Kernel_Check built for
+*   it; Kernel_Select may swap it while other threads generate.
+*/
+static const st_kernel *_Atomic KERNEL_BOUND = NULL;
+static pthread_once_t KERNEL_ONCE = PTHREAD_ONCE_INIT;
+
+static void kernel_bind(void)
+{
+    for (int cnt_i = 0; KERNEL_TABLE[cnt_i] != NULL; cnt_i++)
+    {
+        if (Kernel_Check(KERNEL_TABLE[cnt_i]))
+        {
+            atomic_store_explicit(&KERNEL_BOUND, KERNEL_TABLE[cnt_i], memory_order_release);
+            return;
+        }
+    }
+    atomic_store_explicit(&KERNEL_BOUND, &KERNEL_ARIA_REF, memory_order_release);
+}
+
+void Kernel_Init(void)
+{
+    pthread_once(&KERNEL_ONCE, kernel_bind);
+}
+
+const st_kernel *Kernel(void)
+{
+    const st_kernel *kernel = atomic_load_explicit(&KERNEL_BOUND, memory_order_acquire);
+
+    if (kernel == NULL)
+    {
+        Kernel_Init();
+        kernel = atomic_load_explicit(&KERNEL_BOUND, memory_order_acquire);
+    }
+    return kernel;
+}
+
+const st_kernel *Kernel_Find(const char *name)
+{
+    for (int cnt_i = 0; KERNEL_TABLE[cnt_i] != NULL; cnt_i++)
+    {
+        if (strcmp(KERNEL_TABLE[cnt_i]->name, name) == 0)
+            return KERNEL_TABLE[cnt_i];
+    }
+    return NULL;
+}
+
+//! force a kernel (benchmarks, debugging); refused if the CPU cannot run it
+int Kernel_Select(const st_kernel *kernel)
+{
+    Kernel_Init();
+    if (kernel == NULL || !Kernel_Check(kernel))
+        return FALSE;
+    atomic_store_explicit(&KERNEL_BOUND, kernel, memory_order_release);
+    return TRUE;
+}
@@ -0,0 +1,322 @@
+#include "header.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+extern const u8 S[4][256];
+
+/*
+*   Constants shared by every SIMD kernel, derived from the scalar ARIA
+*   tables in Kernel_SIMD_Init so that nothing here is typed in by hand.
+*/
+static struct {
+    u8 dl[7][16];                                      // DL = XOR of 7 byte permutations
+    u8 ms1[2][16], ms2[2][16], mx1[2][16], mx[2][16];  // S-box type masks for odd / even rounds
+    u8 low4[16], sr[16], isr[16];                      // AES-NI: nibble mask, (inverse) ShiftRows
+    u8 g_lo[16], g_hi[16], h_lo[16], h_hi[16];         // AES-NI: S1 -> S2 and S2^-1 -> S1^-1 affine maps
+    u8 a1[16], a2[16], a1_inv[16], a2_inv[16], ident[16]; // GFNI: affine matrices
+    u8 c_out[2][16], d_in[2][16];                      // GFNI: affine constants
+} ARIA_SIMD;
+
+//! GF(2^8) with the AES / ARIA polynomial x^8 + x^4 + x^3 + x + 1
+static u8 gf_mul(u8 a, u8 b)
+{
+    u8 r = 0;
+    while (b)
+    {
+        if (b & 1)
+            r ^= a;
+        a = (u8)((a << 1) ^ ((a & 0x80) ? 0x1b : 0x00));
+        b >>= 1;
+    }
+    return r;
+}
+
+static u8 gf_inv(u8 a)
+{
+    for (int b = 1; b < 256 && a != 0; b++)
+    {
+        if (gf_mul(a, (u8)b) == 1)
+            return (u8)b;
+    }
+    return 0;
+}
+
+//! gf2p8affine: result bit i = parity(A.byte[7 - i] & x), col[k] = L(1 << k)
+static void set_matrix(u8 *dst, const u8 col[8])
+{
+    unsigned long long A = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        u8 row = 0;
+        for (int k = 0; k < 8; k++)
+            row |= (u8)(((col[k] >> i) & 1) << k);
+        A |= (unsigned long long)row << (8 * (7 - i));
+    }
+    for (int cnt_i = 0; cnt_i < 8; cnt_i++)
+    {
+        dst[cnt_i] = (u8)(A >> (8 * cnt_i));
+        dst[8 + cnt_i] = dst[cnt_i];
+    }
+}
+
+//! S(x) = L(inv(x)) ^ S(0): store L and L^-1, return L^-1(S(0))
+static u8 set_sbox_matrix(const u8 *sbox, u8 *a, u8 *a_inv)
+{
+    u8 col[8], col_inv[8], L[256], L_inv[256];
+
+    for (int k = 0; k < 8; k++)
+        col[k] = sbox[gf_inv((u8)(1 << k))] ^ sbox[0];
+    for (int x = 0; x < 256; x++)
+    {
+        L[x] = 0;
+        for (int k = 0; k < 8; k++)
+            if (x & (1 << k))
+                L[x] ^= col[k];
+    }
+    for (int x = 0; x < 256; x++)
+        L_inv[L[x]] = (u8)x;
+    for (int k = 0; k < 8; k++)
+        col_inv[k] = L_inv[1 << k];
+    set_matrix(a, col);
+    set_matrix(a_inv, col_inv);
+    return L_inv[sbox[0]];
+}
+
+//! affine byte map f split into low / high nibble tables
+static void set_nibble_lut(u8 *lo, u8 *hi, const u8 *f)
+{
+    for (int n = 0; n < 16; n++)
+    {
+        lo[n] = f[n];
+        hi[n] = f[n << 4] ^ f[0];
+    }
+}
+
+/*
+*   DL as 7 permutations: its 16x16 dependency matrix is 7-regular, so a
+*   perfect matching always exists and can be peeled off 7 times.
+*/
+static int dl_match(int adj[16][16], int i, int *seen, int *owner)
+{
+    for (int j = 0; j < 16; j++)
+    {
+        if (adj[i][j] && !seen[j])
+        {
+            seen[j] = 1;
+            if (owner[j] < 0 || dl_match(adj, owner[j], seen, owner))
+            {
+                owner[j] = i;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void set_dl(void)
+{
+    int adj[16][16];
+    u8 in[16], out[16];
+
+    for (int j = 0; j < 16; j++)
+    {
+        memset(in, 0, sizeof(in));
+        in[j] = 1;
+        DL(in, out);
+        for (int i = 0; i < 16; i++)
+            adj[i][j] = out[i] != 0;
+    }
+    for (int k = 0; k < 7; k++)
+    {
+        int owner[16];
+        memset(owner, -1, sizeof(owner));
+        for (int i = 0; i < 16; i++)
+        {
+            int seen[16] = {0};
+            dl_match(adj, i, seen, owner);
+        }
+        for (int j = 0; j < 16; j++)
+        {
+            if (owner[j] < 0)
+                continue;
+            ARIA_SIMD.dl[k][owner[j]] = (u8)j;
+            adj[owner[j]][j] = 0;
+        }
+    }
+}
+
+void Kernel_SIMD_Init(void)
+{
+    u8 f[256];
+    u8 d1, d2;
+
+    set_dl();
+
+    //! byte j uses S[(j + 2p) % 4]: S1, S2, S1^-1, S2^-1
+    for (int p = 0; p < 2; p++)
+    {
+        for (int j = 0; j < 16; j++)
+        {
+            int type = (j + 2 * p) % 4;
+            ARIA_SIMD.ms1[p][j] = type == 0 ? 0xff : 0x00;
+            ARIA_SIMD.ms2[p][j] = type == 1 ? 0xff : 0x00;
+            ARIA_SIMD.mx1[p][j] = type == 2 ? 0xff : 0x00;
+            ARIA_SIMD.mx[p][j] = type >= 2 ? 0xff : 0x00;
+        }
+    }
+
+    //! AES-NI: aesenclast / aesdeclast give S1 / S1^-1 once ShiftRows is undone
+    for (int r = 0; r < 4; r++)
+    {
+        for (int c = 0; c < 4; c++)
+        {
+            ARIA_SIMD.sr[r + 4 * c] = (u8)(r + 4 * ((c + r) % 4));
+            ARIA_SIMD.isr[r + 4 * c] = (u8)(r + 4 * ((c + 4 - r) % 4));
+        }
+    }
+    memset(ARIA_SIMD.low4, 0x0f, 16);
+    for (int x = 0; x < 256; x++)
+        f[x] = S[1][S[2][x]]; // S2(x) = f(S1(x))
+    set_nibble_lut(ARIA_SIMD.g_lo, ARIA_SIMD.g_hi, f);
+    for (int x = 0; x < 256; x++)
+        f[x] = S[0][S[3][x]]; // S2^-1(x) = S1^-1(f(x))
+    set_nibble_lut(ARIA_SIMD.h_lo, ARIA_SIMD.h_hi, f);
+
+    //! GFNI: S(x) = A inv(x) ^ c, S^-1(x) = inv(A^-1 x ^ A^-1 c)
+    d1 = set_sbox_matrix(S[0], ARIA_SIMD.a1, ARIA_SIMD.a1_inv);
+    d2 = set_sbox_matrix(S[1], ARIA_SIMD.a2, ARIA_SIMD.a2_inv);
+    {
+        u8 col[8];
+        for (int k = 0; k < 8; k++)
+            col[k] = (u8)(1 << k);
+        set_matrix(ARIA_SIMD.ident, col);
+    }
+    for (int p = 0; p < 2; p++)
+    {
+        for (int j = 0; j < 16; j++)
+        {
+            int type = (j + 2 * p) % 4;
+            ARIA_SIMD.c_out[p][j] = type == 0 ? S[0][0] : type == 1 ? S[1][0] : 0x00;
+            ARIA_SIMD.d_in[p][j] = type == 2 ? d1 : type == 3 ? d2 : 0x00;
+        }
+    }
+}
+
+//! row o of lane l's round keys, for V_LOADK
+#define V_ROW(k, o, l) _mm_loadu_si128((const __m128i *)((k)[l] + (o)))
+
+/*
+*   SSSE3 + AES-NI, 1 block per register
+*/
+#define KN(x) x##_aesni
+#define TARGET __attribute__((target("ssse3,aes")))
+#define VEC __m128i
+#define LANES 1
+#define V_LOAD(p) _mm_loadu_si128((const __m128i *)(p))
+#define V_STORE(p, v) _mm_storeu_si128((__m128i *)(p), (v))
+#define V_LOAD1(p) V_LOAD(p)
+#define V_STORE1(p, v) V_STORE(p, v)
+#define V_BCAST(p) V_LOAD(p)
+#define V_LOADK(k, o) V_LOAD((k)[0] + (o))
+#define V_ZERO() _mm_setzero_si128()
+#define V_XOR(a, b) _mm_xor_si128((a), (b))
+#define V_AND(a, b) _mm_and_si128((a), (b))
+#define V_OR(a, b) _mm_or_si128((a), (b))
+#define V_ANDN(a, b) _mm_andnot_si128((a), (b))
+#define V_SHUF(a, b) _mm_shuffle_epi8((a), (b))
+#define V_SRL4(a) _mm_srli_epi16((a), 4)
+#define SBOX_AES
+#define V_AESENCLAST(a, k) _mm_aesenclast_si128((a), (k))
+#define V_AESDECLAST(a, k) _mm_aesdeclast_si128((a), (k))
+#include "Kernel_SIMD.h"
+
+/*
+*   AVX2 + VAES, 2 blocks per register
+*/
+#define KN(x) x##_vaes
+#define TARGET __attribute__((target("avx2,aes,vaes")))
+#define VEC __m256i
+#define LANES 2
+#define V_LOAD(p) _mm256_loadu_si256((const __m256i *)(p))
+#define V_STORE(p, v) _mm256_storeu_si256((__m256i *)(p), (v))
+#define V_LOAD1(p) _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(p)))
+#define V_STORE1(p, v) _mm_storeu_si128((__m128i *)(p), _mm256_castsi256_si128(v))
+#define V_BCAST(p) _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(p)))
+#define V_LOADK(k, o) _mm256_inserti128_si256(_mm256_castsi128_si256(V_ROW(k, o, 0)), V_ROW(k, o, 1), 1)
+#define V_ZERO() _mm256_setzero_si256()
+#define V_XOR(a, b) _mm256_xor_si256((a), (b))
+#define V_AND(a, b) _mm256_and_si256((a), (b))
+#define V_OR(a, b) _mm256_or_si256((a), (b))
+#define V_ANDN(a, b) _mm256_andnot_si256((a), (b))
+#define V_SHUF(a, b) _mm256_shuffle_epi8((a), (b))
+#define V_SRL4(a) _mm256_srli_epi16((a), 4)
+#define SBOX_AES
+#define V_AESENCLAST(a, k) _mm256_aesenclast_epi128((a), (k))
+#define V_AESDECLAST(a, k) _mm256_aesdeclast_epi128((a), (k))
+#include "Kernel_SIMD.h"
+
+/*
+*   AVX2 + GFNI, 2 blocks per register
+*/
+#define KN(x) x##_gfni
+#define TARGET __attribute__((target("avx2,gfni")))
+#define VEC __m256i
+#define LANES 2
+#define V_LOAD(p) _mm256_loadu_si256((const __m256i *)(p))
+#define V_STORE(p, v) _mm256_storeu_si256((__m256i *)(p), (v))
+#define V_LOAD1(p) _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(p)))
+#define V_STORE1(p, v) _mm_storeu_si128((__m128i *)(p), _mm256_castsi256_si128(v))
+#define V_BCAST(p) _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(p)))
+#define V_LOADK(k, o) _mm256_inserti128_si256(_mm256_castsi128_si256(V_ROW(k, o, 0)), V_ROW(k, o, 1), 1)
+#define V_ZERO() _mm256_setzero_si256()
+#define V_XOR(a, b) _mm256_xor_si256((a), (b))
+#define V_AND(a, b) _mm256_and_si256((a), (b))
+#define V_OR(a, b) _mm256_or_si256((a), (b))
+#define V_ANDN(a, b) _mm256_andnot_si256((a), (b))
+#define V_SHUF(a, b) _mm256_shuffle_epi8((a), (b))
+#define V_SRL4(a) _mm256_srli_epi16((a), 4)
+#define SBOX_GFNI
+#define V_AFFINE(x, m) _mm256_gf2p8affine_epi64_epi8((x), (m), 0)
+#define V_AFFINEINV(x, m) _mm256_gf2p8affineinv_epi64_epi8((x), (m), 0)
+#include "Kernel_SIMD.h"
+
+/*
+*   AVX-512 + GFNI, 4 blocks per register
+*/
+#define KN(x) x##_gfni512
+#define TARGET __attribute__((target("avx512f,avx512bw,avx512vl,gfni")))
+#define VEC __m512i
+#define LANES 4
+#define V_LOAD(p) _mm512_loadu_si512((const void *)(p))
+#define V_STORE(p, v) _mm512_storeu_si512((void *)(p), (v))
+#define V_LOAD1(p) _mm512_castsi128_si512(_mm_loadu_si128((const __m128i *)(p)))
+#define V_STORE1(p, v) _mm_storeu_si128((__m128i *)(p), _mm512_castsi512_si128(v))
+#define V_BCAST(p) _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *)(p)))
+#define V_LOADK(k, o) _mm512_inserti32x4(_mm512_inserti32x4(_mm512_inserti32x4(_mm512_castsi128_si512(V_ROW(k, o, 0)), \
+    V_ROW(k, o, 1), 1), V_ROW(k, o, 2), 2), V_ROW(k, o, 3), 3)
+#define V_ZERO() _mm512_setzero_si512()
+#define V_XOR(a, b) _mm512_xor_si512((a), (b))
+#define V_AND(a, b) _mm512_and_si512((a), (b))
+#define V_OR(a, b) _mm512_or_si512((a), (b))
+#define V_ANDN(a, b) _mm512_andnot_si512((a), (b))
+#define V_SHUF(a, b) _mm512_shuffle_epi8((a), (b))
+#define V_SRL4(a) _mm512_srli_epi16((a), 4)
+#define SBOX_GFNI
+#define V_AFFINE(x, m) _mm512_gf2p8affine_epi64_epi8((x), (m), 0)
+#define V_AFFINEINV(x, m) _mm512_gf2p8affineinv_epi64_epi8((x), (m), 0)
+#include "Kernel_SIMD.h"
+
+const st_kernel KERNEL_ARIA_AESNI = {
+    "aria_aesni", CPU_SSSE3 | CPU_AESNI, EncKeySetup_W64, ecb_aesni, ecb_keys_aesni, ctr_aesni, cbc_mac_aesni, cbc_mac_chains_aesni, f_round_aesni};
+
+const st_kernel KERNEL_ARIA_VAES = {
+    "aria_vaes", CPU_AVX2 | CPU_AESNI | CPU_VAES, EncKeySetup_W64, ecb_vaes, ecb_keys_vaes, ctr_vaes, cbc_mac_vaes, cbc_mac_chains_vaes, f_round_vaes};
+
+const st_kernel KERNEL_ARIA_GFNI = {
+    "aria_gfni", CPU_AVX2 | CPU_GFNI, EncKeySetup_W64, ecb_gfni, ecb_keys_gfni, ctr_gfni, cbc_mac_gfni, cbc_mac_chains_gfni, f_round_gfni};
+
+const st_kernel KERNEL_ARIA_GFNI512 = {
+    "aria_gfni512", CPU_AVX512 | CPU_GFNI, EncKeySetup_W64, ecb_gfni512, ecb_keys_gfni512, ctr_gfni512, cbc_mac_gfni512, cbc_mac_chains_gfni512, f_round_gfni512};
+
+#endif
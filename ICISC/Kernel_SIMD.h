@@ -0,0 +1,332 @@
+/*
+*   ARIA SIMD kernel template
+*   Included by Kernel_SIMD.c once per vector width / S-box method.
+*
+*   One block per 128-bit lane. The S-layer computes every S-box type for the
+*   whole register and blends them by byte position, the diffusion layer is
+*   the XOR of 7 byte shuffles (ARIA_SIMD.dl).
+*
+*   Parameters: KN(x), TARGET, VEC, LANES, V_LOAD, V_STORE, V_LOAD1, V_STORE1,
+*   V_BCAST, V_LOADK (one 16-byte row per lane from LANES pointers), V_ZERO, V_XOR, V_AND, V_OR, V_ANDN, V_SHUF, V_SRL4 and either
+*   SBOX_AES (V_AESENCLAST, V_AESDECLAST) or SBOX_GFNI (V_AFFINE, V_AFFINEINV)
+*/
+
+#define KN_WAYS 4
+
+typedef struct {
+    VEC dl[7];
+    VEC ms1[2], ms2[2], mx1[2], mx[2];
+#if defined(SBOX_AES)
+    VEC low4, sr, isr, g_lo, g_hi, h_lo, h_hi;
+#else
+    VEC a1, a2, a1_inv, a2_inv, ident, c_out[2], d_in[2];
+#endif
+} KN(st_consts);
+
+static TARGET void KN(load_consts)(KN(st_consts) *c)
+{
+    for (int cnt_i = 0; cnt_i < 7; cnt_i++)
+        c->dl[cnt_i] = V_BCAST(ARIA_SIMD.dl[cnt_i]);
+    for (int p = 0; p < 2; p++)
+    {
+        c->ms1[p] = V_BCAST(ARIA_SIMD.ms1[p]);
+        c->ms2[p] = V_BCAST(ARIA_SIMD.ms2[p]);
+        c->mx1[p] = V_BCAST(ARIA_SIMD.mx1[p]);
+        c->mx[p] = V_BCAST(ARIA_SIMD.mx[p]);
+#if defined(SBOX_GFNI)
+        c->c_out[p] = V_BCAST(ARIA_SIMD.c_out[p]);
+        c->d_in[p] = V_BCAST(ARIA_SIMD.d_in[p]);
+#endif
+    }
+#if defined(SBOX_AES)
+    c->low4 = V_BCAST(ARIA_SIMD.low4);
+    c->sr = V_BCAST(ARIA_SIMD.sr);
+    c->isr = V_BCAST(ARIA_SIMD.isr);
+    c->g_lo = V_BCAST(ARIA_SIMD.g_lo);
+    c->g_hi = V_BCAST(ARIA_SIMD.g_hi);
+    c->h_lo = V_BCAST(ARIA_SIMD.h_lo);
+    c->h_hi = V_BCAST(ARIA_SIMD.h_hi);
+#else
+    c->a1 = V_BCAST(ARIA_SIMD.a1);
+    c->a2 = V_BCAST(ARIA_SIMD.a2);
+    c->a1_inv = V_BCAST(ARIA_SIMD.a1_inv);
+    c->a2_inv = V_BCAST(ARIA_SIMD.a2_inv);
+    c->ident = V_BCAST(ARIA_SIMD.ident);
+#endif
+}
+
+#if defined(SBOX_AES)
+//! affine byte map through two 16-entry nibble tables
+static inline TARGET VEC KN(affine_lut)(const KN(st_consts) *c, VEC lo, VEC hi, VEC x)
+{
+    return V_XOR(V_SHUF(lo, V_AND(x, c->low4)), V_SHUF(hi, V_AND(V_SRL4(x), c->low4)));
+}
+#endif
+
+//! p = 0 : S1 S2 S1^-1 S2^-1, p = 1 : S1^-1 S2^-1 S1 S2
+static inline TARGET VEC KN(sub_layer)(const KN(st_consts) *c, VEC x, int p)
+{
+#if defined(SBOX_AES)
+    VEC f = V_AESENCLAST(V_SHUF(x, c->isr), V_ZERO());
+    VEC g = KN(affine_lut)(c, c->g_lo, c->g_hi, f);
+    VEC y = V_OR(V_AND(x, c->mx1[p]), V_ANDN(c->mx1[p], KN(affine_lut)(c, c->h_lo, c->h_hi, x)));
+    VEC h = V_AESDECLAST(V_SHUF(y, c->sr), V_ZERO());
+    return V_OR(V_OR(V_AND(f, c->ms1[p]), V_AND(g, c->ms2[p])), V_AND(h, c->mx[p]));
+#else
+    VEC f1 = V_AFFINEINV(x, c->a1);
+    VEC f2 = V_AFFINEINV(x, c->a2);
+    VEC u = V_OR(V_AND(V_AFFINE(x, c->a1_inv), c->mx1[p]), V_ANDN(c->mx1[p], V_AFFINE(x, c->a2_inv)));
+    VEC h = V_AFFINEINV(V_XOR(u, c->d_in[p]), c->ident);
+    return V_XOR(V_OR(V_OR(V_AND(f1, c->ms1[p]), V_AND(f2, c->ms2[p])), V_AND(h, c->mx[p])), c->c_out[p]);
+#endif
+}
+
+static inline TARGET VEC KN(diffusion)(const KN(st_consts) *c, VEC x)
+{
+    VEC y = V_SHUF(x, c->dl[0]);
+    for (int cnt_i = 1; cnt_i < 7; cnt_i++)
+        y = V_XOR(y, V_SHUF(x, c->dl[cnt_i]));
+    return y;
+}
+
+//! rounds 1 .. R-1 are full, the last round has no diffusion layer
+static inline __attribute__((always_inline)) TARGET void KN(encrypt)(const KN(st_consts) *c, const VEC *rk, int R, VEC *x, int ways)
+{
+    for (int r = 0; r < R - 1; r++)
+    {
+        for (int w = 0; w < ways; w++)
+            x[w] = KN(diffusion)(c, KN(sub_layer)(c, V_XOR(x[w], rk[r]), r & 1));
+    }
+    for (int w = 0; w < ways; w++)
+        x[w] = V_XOR(KN(sub_layer)(c, V_XOR(x[w], rk[R - 1]), 1), rk[R]);
+}
+
+//! as encrypt, with an own key schedule per way (and per lane)
+static inline __attribute__((always_inline)) TARGET void KN(encrypt_keys)(const KN(st_consts) *c, VEC (*rk)[17], int R, VEC *x, int ways)
+{
+    for (int r = 0; r < R - 1; r++)
+    {
+        for (int w = 0; w < ways; w++)
+            x[w] = KN(diffusion)(c, KN(sub_layer)(c, V_XOR(x[w], rk[w][r]), r & 1));
+    }
+    for (int w = 0; w < ways; w++)
+        x[w] = V_XOR(KN(sub_layer)(c, V_XOR(x[w], rk[w][R - 1]), 1), rk[w][R]);
+}
+
+//! lane l of the vector takes round_key[l], short groups repeat round_key[0]
+static inline TARGET void KN(load_keys)(const u8 *const *round_key, size_t n, int R, VEC *rk)
+{
+    const u8 *key[LANES];
+
+    for (int l = 0; l < LANES; l++)
+        key[l] = round_key[(size_t)l < n ? l : 0];
+    for (int r = 0; r <= R; r++)
+        rk[r] = V_LOADK(key, 16 * r);
+}
+
+static TARGET void KN(ecb)(const u8 *round_key, int R, const u8 *in, u8 *out, size_t blocks)
+{
+    KN(st_consts) c;
+    VEC rk[17], x[KN_WAYS];
+
+    KN(load_consts)(&c);
+    for (int r = 0; r <= R; r++)
+        rk[r] = V_BCAST(round_key + 16 * r);
+
+    for (; blocks >= KN_WAYS * LANES; blocks -= KN_WAYS * LANES)
+    {
+        for (int w = 0; w < KN_WAYS; w++)
+            x[w] = V_LOAD(in + 16 * LANES * w);
+        KN(encrypt)(&c, rk, R, x, KN_WAYS);
+        for (int w = 0; w < KN_WAYS; w++)
+            V_STORE(out + 16 * LANES * w, x[w]);
+        in += 16 * LANES * KN_WAYS;
+        out += 16 * LANES * KN_WAYS;
+    }
+    for (; blocks >= LANES; blocks -= LANES)
+    {
+        x[0] = V_LOAD(in);
+        KN(encrypt)(&c, rk, R, x, 1);
+        V_STORE(out, x[0]);
+        in += 16 * LANES;
+        out += 16 * LANES;
+    }
+#if LANES > 1
+    if (blocks != 0)
+    {
+        u8 buf[16 * LANES] = {0x00};
+        memcpy(buf, in, 16 * blocks);
+        x[0] = V_LOAD(buf);
+        KN(encrypt)(&c, rk, R, x, 1);
+        V_STORE(buf, x[0]);
+        memcpy(out, buf, 16 * blocks);
+    }
+#endif
+}
+
+static TARGET void KN(ecb_keys)(const u8 *const *round_key, int R, const u8 *in, u8 *out, size_t blocks)
+{
+    KN(st_consts) c;
+    VEC rk[KN_WAYS][17], x[KN_WAYS];
+
+    KN(load_consts)(&c);
+    for (; blocks >= KN_WAYS * LANES; blocks -= KN_WAYS * LANES)
+    {
+        for (int w = 0; w < KN_WAYS; w++)
+        {
+            KN(load_keys)(round_key + LANES * w, LANES, R, rk[w]);
+            x[w] = V_LOAD(in + 16 * LANES * w);
+        }
+        KN(encrypt_keys)(&c, rk, R, x, KN_WAYS);
+        for (int w = 0; w < KN_WAYS; w++)
+            V_STORE(out + 16 * LANES * w, x[w]);
+        round_key += LANES * KN_WAYS;
+        in += 16 * LANES * KN_WAYS;
+        out += 16 * LANES * KN_WAYS;
+    }
+    while (blocks > 0)
+    {
+        size_t n = blocks < LANES ? blocks : LANES;
+        u8 buf[16 * LANES] = {0x00};
+
+        KN(load_keys)(round_key, n, R, rk[0]);
+        memcpy(buf, in, 16 * n);
+        x[0] = V_LOAD(buf);
+        KN(encrypt_keys)(&c, rk, R, x, 1);
+        V_STORE(buf, x[0]);
+        memcpy(out, buf, 16 * n);
+        round_key += n;
+        in += 16 * n;
+        out += 16 * n;
+        blocks -= n;
+    }
+}
+
+//! counter blocks are written to out and encrypted in place
+static TARGET void KN(ctr)(const u8 *round_key, int R, u8 *V, u8 *out, size_t blocks)
+{
+    for (size_t cnt_i = 0; cnt_i < blocks; cnt_i++)
+    {
+        Counter_Add(V, 1);
+        memcpy(out + 16 * cnt_i, V, 16);
+    }
+    KN(ecb)(round_key, R, out, out, blocks);
+}
+
+//! one chain is serial, only lane 0 carries data
+static TARGET void KN(cbc_mac)(const u8 *round_key, int R, u8 *chain, const u8 *in, size_t blocks)
+{
+    KN(st_consts) c;
+    VEC rk[17], x[1];
+
+    KN(load_consts)(&c);
+    for (int r = 0; r <= R; r++)
+        rk[r] = V_BCAST(round_key + 16 * r);
+
+    x[0] = V_LOAD1(chain);
+    for (size_t cnt_i = 0; cnt_i < blocks; cnt_i++)
+    {
+        x[0] = V_XOR(x[0], V_LOAD1(in + 16 * cnt_i));
+        KN(encrypt)(&c, rk, R, x, 1);
+    }
+    V_STORE1(chain, x[0]);
+}
+
+//! independent chains in the lanes, one shared key
+static TARGET void KN(cbc_mac_chains)(const u8 *round_key, int R, u8 *chain, const u8 *const *in, size_t chains, size_t blocks)
+{
+    KN(st_consts) c;
+    VEC rk[17], x[KN_WAYS];
+
+    KN(load_consts)(&c);
+    for (int r = 0; r <= R; r++)
+        rk[r] = V_BCAST(round_key + 16 * r);
+
+    for (; chains >= KN_WAYS * LANES; chains -= KN_WAYS * LANES)
+    {
+        for (int w = 0; w < KN_WAYS; w++)
+            x[w] = V_LOAD(chain + 16 * LANES * w);
+        for (size_t cnt_i = 0; cnt_i < blocks; cnt_i++)
+        {
+            for (int w = 0; w < KN_WAYS; w++)
+                x[w] = V_XOR(x[w], V_LOADK(in + LANES * w, 16 * cnt_i));
+            KN(encrypt)(&c, rk, R, x, KN_WAYS);
+        }
+        for (int w = 0; w < KN_WAYS; w++)
+            V_STORE(chain + 16 * LANES * w, x[w]);
+        chain += 16 * LANES * KN_WAYS;
+        in += LANES * KN_WAYS;
+    }
+    while (chains > 0)
+    {
+        size_t n = chains < LANES ? chains : LANES;
+        const u8 *msg[LANES];
+        u8 buf[16 * LANES] = {0x00};
+
+        for (int l = 0; l < LANES; l++)
+            msg[l] = in[(size_t)l < n ? l : 0];
+        memcpy(buf, chain, 16 * n);
+        x[0] = V_LOAD(buf);
+        for (size_t cnt_i = 0; cnt_i < blocks; cnt_i++)
+        {
+            x[0] = V_XOR(x[0], V_LOADK(msg, 16 * cnt_i));
+            KN(encrypt)(&c, rk, R, x, 1);
+        }
+        V_STORE(buf, x[0]);
+        memcpy(chain, buf, 16 * n);
+        chain += 16 * n;
+        in += n;
+        chains -= n;
+    }
+}
+
+//! key schedule F-round, x = DL(SL_p(x ^ ck)) on every block
+static TARGET void KN(f_round)(const u8 *ck, int p, u8 *x, size_t blocks)
+{
+    KN(st_consts) c;
+    VEC k, v;
+
+    KN(load_consts)(&c);
+    k = V_BCAST(ck);
+    for (; blocks >= LANES; blocks -= LANES)
+    {
+        v = V_LOAD(x);
+        V_STORE(x, KN(diffusion)(&c, KN(sub_layer)(&c, V_XOR(v, k), p)));
+        x += 16 * LANES;
+    }
+#if LANES > 1
+    if (blocks != 0)
+    {
+        u8 buf[16 * LANES] = {0x00};
+        memcpy(buf, x, 16 * blocks);
+        v = V_LOAD(buf);
+        V_STORE(buf, KN(diffusion)(&c, KN(sub_layer)(&c, V_XOR(v, k), p)));
+        memcpy(x, buf, 16 * blocks);
+    }
+#endif
+}
+
+#undef KN_WAYS
+#undef KN
+#undef TARGET
+#undef VEC
+#undef LANES
+#undef V_LOAD
+#undef V_STORE
+#undef V_LOAD1
+#undef V_STORE1
+#undef V_BCAST
+#undef V_LOADK
+#undef V_ZERO
+#undef V_XOR
+#undef V_AND
+#undef V_OR
+#undef V_ANDN
+#undef V_SHUF
+#undef V_SRL4
+#undef V_AESENCLAST
+#undef V_AESDECLAST
+#undef V_AFFINE
+#undef V_AFFINEINV
+#undef SBOX_AES
+#undef SBOX_GFNI
@@ -0,0 +1,123 @@
+#include "header.h"
+#include <time.h>
+#include <unistd.h>
+
+/*
+*   Kernel self-tuning
+*   Feature flags do not always predict speed (wide units that throttle,
+*   gathers that lose to scalar code), so every eligible kernel is timed on
+*   a short DRBG-sized workload and the fastest one is bound.
+*
+*   profile format : "kernel <signature> <features> <name>"
+*/
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+//! best of TUNE_ROUNDS: key setup + TUNE_BLOCKS counter blocks
+static double kernel_time(const st_kernel *kernel)
+{
+    static const u8 key[KEY_SIZE] = {0x00};
+    u8 round_key[ROUND_KEY_LEN];
+    u8 V[BLOCK_SIZE] = {0x00};
+    u8 out[TUNE_BLOCKS * BLOCK_SIZE];
+    double best = 0;
+
+    //! warm-up, lets wide units leave their low-power state
+    kernel->ctr(round_key, kernel->key_setup(key, round_key, KEY_BIT), V, out, TUNE_BLOCKS);
+
+    for (int cnt_i = 0; cnt_i < TUNE_ROUNDS; cnt_i++)
+    {
+        double start = now_ns();
+        kernel->ctr(round_key, kernel->key_setup(key, round_key, KEY_BIT), V, out, TUNE_BLOCKS);
+        double elapsed = now_ns() - start;
+        if (cnt_i == 0 || elapsed < best)
+            best = elapsed;
+    }
+    return best;
+}
+
+static const st_kernel *profile_load(const char *profile)
+{
+    FILE *fp = fopen(profile, "r");
+    unsigned int signature = 0, features = 0;
+    char name[64] = {0};
+    const st_kernel *kernel = NULL;
+
+    if (fp == NULL)
+        return NULL;
+    if (fscanf(fp, "kernel %x %x %63s", &signature, &features, name) == 3 &&
+        signature == CPU_Signature() && features == CPU_Features())
+    {
+        kernel = Kernel_Find(name);
+    }
+    fclose(fp);
+    return kernel;
+}
+
+static void profile_store(const char *profile, const st_kernel *kernel)
+{
+    char temp[4096];
+    FILE *fp;
+    int fd;
+
+    //! write a unique file next to the profile then rename it over, a
+    //! concurrent start never reads half a profile nor shares a temp file
+    if (snprintf(temp, sizeof(temp), "%s.XXXXXX", profile) >= (int)sizeof(temp))
+        return;
+    fd = mkstemp(temp);
+    if (fd < 0)
+        return;
+    fp = fdopen(fd, "w");
+    if (fp == NULL)
+    {
+        close(fd);
+        unlink(temp);
+        return;
+    }
+    fprintf(fp, "kernel %x %x %s\n", CPU_Signature(), CPU_Features(), kernel->name);
+    if (fclose(fp) != 0 || rename(temp, profile) != 0)
+        unlink(temp);
+}
+
+//! profile may be NULL to always measure
+const st_kernel *Kernel_Tune(const char *profile)
+{
+    const st_kernel *best = NULL;
+    double best_time = 0;
+
+    if (profile != NULL)
+    {
+        best = profile_load(profile);
+        if (best != NULL && Kernel_Select(best))
+            return best;
+        //! a stale profile or another CPU's: measure and write it again
+        best = NULL;
+    }
+
+    for (int cnt_i = 0; KERNEL_TABLE[cnt_i] != NULL; cnt_i++)
+    {
+        const st_kernel *kernel = KERNEL_TABLE[cnt_i];
+        double elapsed;
+
+        //! also checks the output against the reference kernel
+        if (!Kernel_Check(kernel))
+            continue;
+        elapsed = kernel_time(kernel);
+        if (best == NULL || elapsed < best_time)
+        {
+            best = kernel;
+            best_time = elapsed;
+        }
+    }
+
+    if (best == NULL || !Kernel_Select(best))
+        return Kernel();
+    if (profile != NULL)
+        profile_store(profile, best);
+    return best;
+}
@@ -0,0 +1,128 @@
+#define _GNU_SOURCE // sched_getcpu, CPU_SET
+#include "header.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+/*
+*   NUMA placement
+*
+*   The CPU to node map is read once from /sys/devices/system/node, so no
+*   libnuma is needed; the node of the caller is then sched_getcpu (vDSO)
+*   and a table lookup. Memory is placed with the mbind system call as
+*   MPOL_PREFERRED, a full node falls back to another instead of failing.
+*   Without NUMA (one node, no sysfs) every call is a no-op on node 0.
+*/
+static struct {
+    int nodes;
+    unsigned char node[NUMA_CPUS];
+    cpu_set_t cpus[NUMA_NODES];
+} NUMA;
+
+static pthread_once_t NUMA_ONCE = PTHREAD_ONCE_INIT;
+static _Atomic int NUMA_READY = FALSE;
+
+//! a cpulist such as "0-3,8-11" into node's CPUs
+static void numa_cpulist(FILE *fp, int node)
+{
+    unsigned int lo, hi;
+    int c;
+
+    while (fscanf(fp, "%u", &lo) == 1)
+    {
+        hi = lo;
+        c = fgetc(fp);
+        if (c == '-')
+        {
+            if (fscanf(fp, "%u", &hi) != 1)
+                return;
+            c = fgetc(fp);
+        }
+        for (unsigned int cnt_i = lo; cnt_i <= hi && cnt_i < NUMA_CPUS; cnt_i++)
+        {
+            NUMA.node[cnt_i] = (unsigned char)node;
+            CPU_SET(cnt_i, &NUMA.cpus[node]);
+        }
+        if (c != ',')
+            return;
+    }
+}
+
+static void numa_init(void)
+{
+    char path[64];
+
+    NUMA.nodes = 1;
+    for (int cnt_i = 0; cnt_i < NUMA_NODES; cnt_i++)
+    {
+        FILE *fp;
+
+        CPU_ZERO(&NUMA.cpus[cnt_i]);
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", cnt_i);
+        fp = fopen(path, "r");
+        if (fp == NULL)
+            continue;
+        numa_cpulist(fp, cnt_i);
+        fclose(fp);
+        if (CPU_COUNT(&NUMA.cpus[cnt_i]) != 0)
+            NUMA.nodes = cnt_i + 1;
+    }
+    atomic_store_explicit(&NUMA_READY, TRUE, memory_order_release);
+}
+
+static void numa_ready(void)
+{
+    if (!atomic_load_explicit(&NUMA_READY, memory_order_acquire))
+        pthread_once(&NUMA_ONCE, numa_init);
+}
+
+//! highest node with CPUs + 1, 1 without NUMA
+int Numa_Nodes(void)
+{
+    numa_ready();
+    return NUMA.nodes;
+}
+
+//! node of the CPU the caller runs on, 0 when unknown
+int Numa_Node(void)
+{
+    int cpu;
+
+    numa_ready();
+    if (NUMA.nodes == 1)
+        return 0;
+    cpu = sched_getcpu();
+    if (cpu < 0 || cpu >= NUMA_CPUS)
+        return 0;
+    return NUMA.node[cpu];
+}
+
+//! prefer node for the pages of ptr, len not yet touched; page-aligned ptr
+int Numa_Bind(void *ptr, size_t len, int node)
+{
+    unsigned long mask[(NUMA_NODES + 63) / 64] = {0};
+
+    numa_ready();
+    if (NUMA.nodes == 1 || node < 0 || node >= NUMA.nodes)
+        return TRUE;
+    mask[node / 64] = 1UL << (node % 64);
+#if defined(SYS_mbind)
+    return syscall(SYS_mbind, ptr, len, MPOL_PREFERRED, mask, (unsigned long)NUMA_NODES + 1, 0) == 0;
+#else
+    (void)ptr;
+    (void)len;
+    return FALSE;
+#endif
+}
+
+//! run the calling thread on node's CPUs only
+int Numa_Pin(int node)
+{
+    numa_ready();
+    if (NUMA.nodes == 1 || node < 0 || node >= NUMA.nodes || CPU_COUNT(&NUMA.cpus[node]) == 0)
+        return TRUE;
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &NUMA.cpus[node]) == 0;
+}
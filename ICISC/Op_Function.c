@@ -3,6 +3,8 @@
 void derived_function_Optimize(u8 *input_data, u8 *seed, u8* LUK_Table)
 {
     volatile int cnt_i = 0, cnt_j = 0, cnt_k = 0;
+    const st_kernel *kernel = Kernel();
+    int R = 0;
     u8 CBC_KEY[32] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f};
     u8 chain_value[BLOCK_SIZE] = {0x00};
     u8 KEYandV[LEN_SEED * BLOCK_SIZE] = {0x00};
@@ -12,7 +14,6 @@ void derived_function_Optimize(u8 *input_data, u8 *seed, u8* LUK_Table)
     {
         in[cnt_i + 24] = input_data[cnt_i];
     }
-    in[cnt_i] = N_CONSTANT;
     in[19] = INSTANCE_INPUT;
     in[23] = N_DF;
     in[24 + INSTANCE_INPUT] = 0x80;
@@ -21,38 +22,35 @@ void derived_function_Optimize(u8 *input_data, u8 *seed, u8* LUK_Table)
     /*
     * AVR function Setting
     */
-    u8 round_key[16 * 17] = {0x00};
+    u8 round_key[ROUND_KEY_LEN] = {0x00};
 
     //! step1
+    R = kernel->key_setup(CBC_KEY, round_key, KEY_BIT);
     for (cnt_j = 0; cnt_j < LEN_SEED; cnt_j++)
     {
-        for (cnt_i = 0; cnt_i < DF_INPUT_LEN / 16; cnt_i++)
-        {
-            set_state(state, in, 16 * cnt_i);
-            XoR(state, chain_value, BLOCK_SIZE);
-            //!Function
-            Crypt(state, EncKeySetup(CBC_KEY, round_key, 128), round_key, chain_value);
-        }
+        //!Function
+        kernel->cbc_mac(round_key, R, chain_value, in, DF_INPUT_LEN / 16);
         copy_state(KEYandV, chain_value, cnt_j);
         clear(chain_value, BLOCK_SIZE);
         in[3]++;
     }
 
     //! step2
-    u8 key[16] = {0x00};
+    u8 key[KEY_SIZE] = {0x00};
     for (cnt_i = 0; cnt_i < KEY_SIZE; cnt_i++)
     {
         key[cnt_i] = KEYandV[cnt_i];
     }
     for (cnt_i = KEY_SIZE; cnt_i < SEED_LEN; cnt_i++)
     {
-        state[cnt_i] = KEYandV[cnt_i];
+        state[cnt_i - KEY_SIZE] = KEYandV[cnt_i];
     }
 
+    R = kernel->key_setup(key, round_key, KEY_BIT);
     for (cnt_i = 0; cnt_i < LEN_SEED; cnt_i++)
     {
         //!Function
-        Crypt(state, EncKeySetup(key, round_key, 128), round_key, chain_value);
+        kernel->ecb(round_key, R, state, chain_value, 1);
         for (cnt_j = 0; cnt_j < BLOCK_SIZE; cnt_j++)
         {
             seed[cnt_i * BLOCK_SIZE + cnt_j] = chain_value[cnt_j];
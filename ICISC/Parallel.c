@@ -0,0 +1,208 @@
+#include "header.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+/*
+*   Parallel fill
+*
+*   Request r of generate_Bytes outputs E(K_r, V_r + 1 .. V_r + n_r); only
+*   its update, which gives K_r+1 and V_r+1, is sequential. The caller plans
+*   a window of PARALLEL_WINDOW requests (reseeds, key and V of each, the
+*   update) exactly as generate_Bytes would, then every thread, the caller
+*   included, takes PARALLEL_GRAIN byte grains of that window from a shared
+*   atomic index until none are left, so a thread that falls behind simply
+*   takes fewer grains. Output is byte-identical to generate_Bytes.
+*/
+typedef struct _PLAN {
+    u8 key[KEY_SIZE];
+    u8 V[BLOCK_SIZE];
+} st_plan;
+
+typedef struct _PARALLEL {
+    pthread_mutex_t lock;
+    pthread_cond_t wake, idle;
+    unsigned long long window; // bumped to start the helpers on a window
+    int busy;                  // helpers still on the current window
+    int running;
+    st_plan plan[PARALLEL_WINDOW];
+    u8 *out;             // output of plan[0]
+    size_t len;          // bytes in this window
+    _Atomic size_t next; // next grain
+} st_parallel;
+
+//! len bytes of planned request plan from counter block first on
+static void parallel_grain(const st_plan *plan, u8 *out, size_t first, size_t len, u8 *round_key)
+{
+    const st_kernel *kernel = Kernel();
+    u8 V[BLOCK_SIZE];
+    u8 last[BLOCK_SIZE];
+    size_t blocks = len / BLOCK_SIZE;
+    int R = kernel->key_setup(plan->key, round_key, KEY_BIT);
+
+    memcpy(V, plan->V, BLOCK_SIZE);
+    Counter_Add(V, first);
+    kernel->ctr(round_key, R, V, out, blocks);
+    if (len % BLOCK_SIZE != 0)
+    {
+        kernel->ctr(round_key, R, V, last, 1);
+        memcpy(out + blocks * BLOCK_SIZE, last, len % BLOCK_SIZE);
+        clear(last, BLOCK_SIZE);
+    }
+    clear(V, BLOCK_SIZE);
+}
+
+static void parallel_work(st_parallel *par)
+{
+    u8 round_key[ROUND_KEY_LEN];
+    size_t grains = (par->len + PARALLEL_GRAIN - 1) / PARALLEL_GRAIN;
+    size_t g;
+
+    while ((g = atomic_fetch_add(&par->next, 1)) < grains)
+    {
+        size_t offset = g * PARALLEL_GRAIN;
+        size_t r = offset / MAX_REQUEST_LEN;
+        size_t n = par->len - offset < PARALLEL_GRAIN ? par->len - offset : PARALLEL_GRAIN;
+
+        parallel_grain(&par->plan[r], par->out + offset, (offset % MAX_REQUEST_LEN) / BLOCK_SIZE, n, round_key);
+    }
+    clear(round_key, ROUND_KEY_LEN);
+}
+
+static void *parallel_main(void *arg)
+{
+    st_parallel *par = (st_parallel *)arg;
+    unsigned long long seen = 0;
+
+    pthread_mutex_lock(&par->lock);
+    for (;;)
+    {
+        while (par->running && par->window == seen)
+            pthread_cond_wait(&par->wake, &par->lock);
+        if (!par->running)
+            break;
+        seen = par->window;
+        pthread_mutex_unlock(&par->lock);
+        parallel_work(par);
+        pthread_mutex_lock(&par->lock);
+        if (--par->busy == 0)
+            pthread_cond_signal(&par->idle);
+    }
+    pthread_mutex_unlock(&par->lock);
+    return NULL;
+}
+
+/*
+*   Plan up to PARALLEL_WINDOW requests of len bytes; returns the bytes
+*   planned, up to a failed reseed if any. Same reseeds, counters and
+*   update as generate_Bytes, without the output.
+*/
+static size_t parallel_plan(st_state *state, st_plan *plan, size_t len, int *failed)
+{
+    const st_kernel *kernel = Kernel();
+    u8 round_key[ROUND_KEY_LEN];
+    u8 seed[SEED_LEN];
+    u8 temp[SEED_LEN];
+    size_t planned = 0;
+
+    for (int cnt_r = 0; cnt_r < PARALLEL_WINDOW && planned < len; cnt_r++)
+    {
+        size_t n = len - planned < MAX_REQUEST_LEN ? len - planned : MAX_REQUEST_LEN;
+        int R;
+
+        if (!Reseed_Check(state, n) || (state->prediction_flag == TRUE && !Reseed_Prediction(state, NULL)))
+        {
+            *failed = TRUE;
+            break;
+        }
+        memcpy(plan[cnt_r].key, state->key, KEY_SIZE);
+        memcpy(plan[cnt_r].V, state->V, BLOCK_SIZE);
+
+        //! update of generate_request, after the (n + 15) / 16 output blocks
+        Counter_Add(state->V, (n + BLOCK_SIZE - 1) / BLOCK_SIZE);
+        copy_state_seed(seed, state);
+        R = kernel->key_setup(state->key, round_key, KEY_BIT);
+        kernel->ctr(round_key, R, state->V, temp, LEN_SEED);
+        for (int cnt_i = 0; cnt_i < KEY_SIZE; cnt_i++)
+        {
+            state->key[cnt_i] = temp[cnt_i] ^ seed[cnt_i];
+        }
+        for (int cnt_i = 0; cnt_i < BLOCK_SIZE; cnt_i++)
+        {
+            state->V[cnt_i] = temp[KEY_SIZE + cnt_i] ^ seed[KEY_SIZE + cnt_i];
+        }
+        state->Reseed_counter++;
+        state->Reseed_bytes += n;
+        planned += n;
+    }
+    clear(round_key, ROUND_KEY_LEN);
+    clear(seed, SEED_LEN);
+    clear(temp, SEED_LEN);
+    return planned;
+}
+
+/*
+*   generate_Bytes(state, out, len, NULL) on nthreads threads (the caller
+*   and nthreads - 1 helpers). Prediction resistance takes prefetched
+*   entropy as generate_Bytes does without re_add_data. FALSE if a reseed
+*   failed; the output before that point is generated.
+*/
+int generate_parallel(st_state *state, u8 *out, size_t len, int nthreads)
+{
+    st_parallel *par;
+    pthread_t thread[PARALLEL_THREADS];
+    int helpers, failed = FALSE;
+
+    if (nthreads > PARALLEL_THREADS)
+        nthreads = PARALLEL_THREADS;
+    //! below two grains per thread the threads cost more than they save
+    if (nthreads <= 1 || len < (size_t)nthreads * 2 * PARALLEL_GRAIN)
+        return generate_Bytes(state, out, len, NULL);
+
+    par = (st_parallel *)Secure_Alloc(sizeof(st_parallel), 0);
+    if (par == NULL)
+        return generate_Bytes(state, out, len, NULL);
+    pthread_mutex_init(&par->lock, NULL);
+    pthread_cond_init(&par->wake, NULL);
+    pthread_cond_init(&par->idle, NULL);
+    par->running = TRUE;
+    //! fewer helpers than asked only makes it slower
+    for (helpers = 0; helpers < nthreads - 1; helpers++)
+    {
+        if (pthread_create(&thread[helpers], NULL, parallel_main, par) != 0)
+            break;
+    }
+
+    while (len > 0 && !failed)
+    {
+        size_t n = parallel_plan(state, par->plan, len, &failed);
+
+        par->out = out;
+        par->len = n;
+        atomic_store(&par->next, 0);
+        pthread_mutex_lock(&par->lock);
+        par->window++;
+        par->busy = helpers;
+        pthread_cond_broadcast(&par->wake);
+        pthread_mutex_unlock(&par->lock);
+
+        parallel_work(par);
+        pthread_mutex_lock(&par->lock);
+        while (par->busy != 0)
+            pthread_cond_wait(&par->idle, &par->lock);
+        pthread_mutex_unlock(&par->lock);
+        out += n;
+        len -= n;
+    }
+
+    pthread_mutex_lock(&par->lock);
+    par->running = FALSE;
+    pthread_cond_broadcast(&par->wake);
+    pthread_mutex_unlock(&par->lock);
+    for (int cnt_i = 0; cnt_i < helpers; cnt_i++)
+        pthread_join(thread[cnt_i], NULL);
+    pthread_mutex_destroy(&par->lock);
+    pthread_cond_destroy(&par->wake);
+    pthread_cond_destroy(&par->idle);
+    Secure_Free(par);
+    return !failed;
+}
@@ -0,0 +1,308 @@
+#include "header.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sched.h>
+
+/*
+*   Output pool
+*
+*   buf holds two halves of POOL_HALF bytes of generator output. pos is the
+*   next unread byte; every byte before pos in the current half is already
+*   zero. When the reader leaves a half it marks it HALF_EMPTY, and whoever
+*   moves it to HALF_FILLING first (refill thread or reader) generates into it.
+*   Pools are SECURE_WIPE secure memory; a forked child finds its pool
+*   empty (zero is HALF_EMPTY) and refills it after its reseed.
+*   A pool is placed on the NUMA node its thread first asked on, and is
+*   refilled by that node's refill thread, pinned there, from that
+*   thread's node-local instance.
+*/
+#define HALF_EMPTY   0
+#define HALF_FILLING 1
+#define HALF_READY   2
+
+typedef struct _POOL {
+    u8 buf[POOL_SIZE];
+    size_t pos;
+    _Atomic int half[2];
+    struct _POOL *next; // refill list
+    unsigned long fork_gen; // generation the halves were filled in
+    int node;
+} __attribute__((aligned(CACHE_LINE))) st_pool;
+
+/*
+*   lock guards the pool list and is held through a scan; sleep_lock only
+*   guards the refill thread's check of pending and its wait on wake, so a
+*   reader signals under it without waiting for a fill.
+*/
+typedef struct _REFILL {
+    pthread_mutex_t lock;
+    pthread_mutex_t sleep_lock;
+    pthread_cond_t wake;
+    pthread_t thread;
+    st_pool *list;
+    _Atomic int running;
+    _Atomic int pending; // halves released since the last scan
+} __attribute__((aligned(CACHE_LINE))) st_refill;
+
+static st_refill REFILL[NUMA_NODES] = {
+    [0 ... NUMA_NODES - 1] = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER}};
+
+static __thread st_pool *POOL = NULL;
+static pthread_key_t POOL_KEY;
+static pthread_once_t POOL_ONCE = PTHREAD_ONCE_INIT;
+
+//! generate into a half the caller owns (HALF_FILLING)
+static int pool_fill(st_pool *pool, int h)
+{
+    if (!DRBG_Thread_Generate(pool->buf + h * POOL_HALF, POOL_HALF))
+    {
+        atomic_store(&pool->half[h], HALF_EMPTY);
+        return FALSE;
+    }
+    atomic_store_explicit(&pool->half[h], HALF_READY, memory_order_release);
+    return TRUE;
+}
+
+static void pool_free(void *ptr)
+{
+    st_pool *pool = (st_pool *)ptr;
+    st_refill *r = &REFILL[pool->node];
+    st_pool **link;
+
+    //! the refill thread fills under the lock, so it is off this pool after this
+    pthread_mutex_lock(&r->lock);
+    for (link = &r->list; *link != NULL; link = &(*link)->next)
+    {
+        if (*link == pool)
+        {
+            *link = pool->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&r->lock);
+    Secure_Free(pool);
+}
+
+/*
+*   In the child only the forking thread is left: the refill threads and
+*   the other pools' threads are gone, their pools are left unreachable
+*   (and zero where MADV_WIPEONFORK is supported).
+*/
+static void pool_child(void)
+{
+    for (int cnt_i = 0; cnt_i < NUMA_NODES; cnt_i++)
+    {
+        pthread_mutex_init(&REFILL[cnt_i].lock, NULL);
+        pthread_mutex_init(&REFILL[cnt_i].sleep_lock, NULL);
+        pthread_cond_init(&REFILL[cnt_i].wake, NULL);
+        atomic_store(&REFILL[cnt_i].running, FALSE);
+        atomic_store(&REFILL[cnt_i].pending, 0);
+        REFILL[cnt_i].list = NULL;
+    }
+    if (POOL != NULL)
+    {
+        REFILL[POOL->node].list = POOL;
+        POOL->next = NULL;
+    }
+}
+
+static void pool_key(void)
+{
+    pthread_key_create(&POOL_KEY, pool_free);
+    pthread_atfork(NULL, NULL, pool_child);
+}
+
+//! drop bytes generated before a fork, the parent hands out the same
+static void pool_fork_check(st_pool *pool)
+{
+    unsigned long gen = Fork_Generation();
+
+    if (pool->fork_gen == gen)
+        return;
+    clear(pool->buf, POOL_SIZE);
+    pool->pos = 0;
+    atomic_store(&pool->half[0], HALF_EMPTY);
+    atomic_store(&pool->half[1], HALF_EMPTY);
+    pool->fork_gen = gen;
+}
+
+static st_pool *pool_new(void)
+{
+    int node = Numa_Node();
+    st_pool *pool;
+
+    pthread_once(&POOL_ONCE, pool_key);
+    pool = (st_pool *)Secure_Alloc_Node(sizeof(st_pool), SECURE_WIPE, node);
+    if (pool == NULL)
+        return NULL;
+    pool->node = node;
+    pool->fork_gen = Fork_Generation();
+    atomic_store(&pool->half[0], HALF_FILLING);
+    atomic_store(&pool->half[1], HALF_FILLING);
+    if (!pool_fill(pool, 0) || !pool_fill(pool, 1))
+    {
+        Secure_Free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&REFILL[node].lock);
+    pool->next = REFILL[node].list;
+    REFILL[node].list = pool;
+    pthread_mutex_unlock(&REFILL[node].lock);
+
+    POOL = pool;
+    pthread_setspecific(POOL_KEY, pool);
+    return pool;
+}
+
+//! the reader is done with half h
+static void pool_release(st_pool *pool, int h)
+{
+    st_refill *r = &REFILL[pool->node];
+
+    atomic_store_explicit(&pool->half[h], HALF_EMPTY, memory_order_release);
+    if (!atomic_load(&r->running))
+        return;
+    //! the refill thread checks pending under sleep_lock, so this signal is never lost
+    atomic_fetch_add(&r->pending, 1);
+    pthread_mutex_lock(&r->sleep_lock);
+    pthread_cond_signal(&r->wake);
+    pthread_mutex_unlock(&r->sleep_lock);
+}
+
+//! make half h readable, filling it here if the refill thread has not
+static int pool_acquire(st_pool *pool, int h)
+{
+    for (;;)
+    {
+        int state = atomic_load_explicit(&pool->half[h], memory_order_acquire);
+
+        if (state == HALF_READY)
+            return TRUE;
+        if (state == HALF_EMPTY && atomic_compare_exchange_strong(&pool->half[h], &state, HALF_FILLING))
+            return pool_fill(pool, h);
+        sched_yield();
+    }
+}
+
+static void *refill_main(void *arg)
+{
+    st_refill *r = (st_refill *)arg;
+
+    //! its thread instance is then allocated on, and seeded from, this node
+    Numa_Pin((int)(r - REFILL));
+    pthread_mutex_lock(&r->sleep_lock);
+    while (atomic_load(&r->running))
+    {
+        if (atomic_exchange(&r->pending, 0) == 0)
+        {
+            pthread_cond_wait(&r->wake, &r->sleep_lock);
+            continue;
+        }
+        pthread_mutex_unlock(&r->sleep_lock);
+        pthread_mutex_lock(&r->lock);
+        for (st_pool *pool = r->list; pool != NULL; pool = pool->next)
+        {
+            for (int h = 0; h < 2; h++)
+            {
+                int state = HALF_EMPTY;
+                if (atomic_compare_exchange_strong(&pool->half[h], &state, HALF_FILLING))
+                    pool_fill(pool, h);
+            }
+        }
+        pthread_mutex_unlock(&r->lock);
+        pthread_mutex_lock(&r->sleep_lock);
+    }
+    pthread_mutex_unlock(&r->sleep_lock);
+    DRBG_Thread_Release();
+    return NULL;
+}
+
+int DRBG_Pool_Get(u8 *random, size_t len)
+{
+    st_pool *pool = POOL;
+
+    //! large requests gain nothing from the copy
+    if (len > POOL_HALF)
+        return DRBG_Thread_Generate(random, len);
+    if (pool == NULL && (pool = pool_new()) == NULL)
+        return FALSE;
+    pool_fork_check(pool);
+
+    while (len > 0)
+    {
+        size_t end = (pool->pos / POOL_HALF + 1) * POOL_HALF;
+        size_t n = end - pool->pos < len ? end - pool->pos : len;
+
+        if (pool->pos % POOL_HALF == 0 && !pool_acquire(pool, (int)(pool->pos / POOL_HALF)))
+            return FALSE;
+
+        memcpy(random, pool->buf + pool->pos, n);
+        memset(pool->buf + pool->pos, 0, n);
+        pool->pos += n;
+        random += n;
+        len -= n;
+
+        if (pool->pos == end)
+        {
+            pool_release(pool, (int)(end / POOL_HALF) - 1);
+            pool->pos = end % POOL_SIZE;
+        }
+    }
+    return TRUE;
+}
+
+//! one refill thread per NUMA node; FALSE if one could not start, its pools fill inline
+int DRBG_Pool_Start(void)
+{
+    int nodes = Numa_Nodes();
+    int ret = TRUE;
+
+    for (int cnt_i = 0; cnt_i < nodes; cnt_i++)
+    {
+        st_refill *r = &REFILL[cnt_i];
+
+        pthread_mutex_lock(&r->sleep_lock);
+        if (!r->running)
+        {
+            r->running = TRUE;
+            r->pending = 1;
+            if (pthread_create(&r->thread, NULL, refill_main, r) != 0)
+            {
+                r->running = FALSE;
+                ret = FALSE;
+            }
+        }
+        pthread_mutex_unlock(&r->sleep_lock);
+    }
+    return ret;
+}
+
+void DRBG_Pool_Stop(void)
+{
+    for (int cnt_i = 0; cnt_i < NUMA_NODES; cnt_i++)
+    {
+        st_refill *r = &REFILL[cnt_i];
+
+        pthread_mutex_lock(&r->sleep_lock);
+        if (!r->running)
+        {
+            pthread_mutex_unlock(&r->sleep_lock);
+            continue;
+        }
+        r->running = FALSE;
+        pthread_cond_signal(&r->wake);
+        pthread_mutex_unlock(&r->sleep_lock);
+        pthread_join(r->thread, NULL);
+    }
+}
+
+//! zeroize and drop the calling thread's pool (also done at thread exit)
+void DRBG_Pool_Release(void)
+{
+    if (POOL == NULL)
+        return;
+    pthread_setspecific(POOL_KEY, NULL);
+    pool_free(POOL);
+    POOL = NULL;
+}
@@ -0,0 +1,218 @@
+#include "header.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+/*
+*   Reseed policy and entropy prefetch
+*
+*   Entropy inputs are read ahead into two buffers of RESEED_PREFETCH inputs.
+*   Reseeds take inputs from the active buffer under the lock (no I/O); once
+*   it is drained they switch to the other one and the prefetch thread
+*   refills the drained buffer with a single read. With the thread stopped
+*   or both buffers empty a reseed reads the default entropy source itself.
+*   A forked child drops the inputs it shares with its parent and has no
+*   prefetch thread until Reseed_Prefetch_Start.
+*/
+#define PREFETCH_BYTES (RESEED_PREFETCH * RESEED_ENTROPY_LEN)
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t thread;
+    _Atomic unsigned long long interval, byte_limit; // read on every generate, no lock
+    u8 buf[2][PREFETCH_BYTES];
+    int full[2]; // filled and not yet drained
+    int active, pos; // buffer reseeds take from, next input in it
+    int running;
+    unsigned long fork_gen; // generation the buffers were read in
+} PREFETCH = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, RESEED_INTERVAL, RESEED_BYTE_LIMIT};
+static pthread_once_t PREFETCH_ONCE = PTHREAD_ONCE_INIT;
+
+//! the child is alone: a lock some parent thread held is free, its thread is gone
+static void prefetch_child(void)
+{
+    pthread_mutex_init(&PREFETCH.lock, NULL);
+    pthread_cond_init(&PREFETCH.wake, NULL);
+    PREFETCH.running = FALSE;
+}
+
+static void prefetch_once(void)
+{
+    pthread_atfork(NULL, NULL, prefetch_child);
+}
+
+//! under the lock: inputs read before a fork are the parent's too
+static void prefetch_fork_check(void)
+{
+    unsigned long gen = Fork_Generation();
+
+    if (PREFETCH.fork_gen == gen)
+        return;
+    clear(PREFETCH.buf[0], sizeof(PREFETCH.buf));
+    PREFETCH.full[0] = FALSE;
+    PREFETCH.full[1] = FALSE;
+    PREFETCH.pos = 0;
+    PREFETCH.running = FALSE;
+    PREFETCH.fork_gen = gen;
+}
+
+static void *prefetch_main(void *arg)
+{
+    u8 in[PREFETCH_BYTES];
+
+    (void)arg;
+    pthread_mutex_lock(&PREFETCH.lock);
+    while (PREFETCH.running)
+    {
+        int b = !PREFETCH.full[PREFETCH.active ^ 1] ? PREFETCH.active ^ 1 : PREFETCH.active;
+
+        if (PREFETCH.full[b])
+        {
+            pthread_cond_wait(&PREFETCH.wake, &PREFETCH.lock);
+            continue;
+        }
+        //! read outside the lock, reseeds never wait on the source
+        pthread_mutex_unlock(&PREFETCH.lock);
+        if (!Entropy_Read(NULL, in, PREFETCH_BYTES))
+        {
+            pthread_mutex_lock(&PREFETCH.lock);
+            break;
+        }
+        pthread_mutex_lock(&PREFETCH.lock);
+        memcpy(PREFETCH.buf[b], in, PREFETCH_BYTES);
+        PREFETCH.full[b] = TRUE;
+        if (b == PREFETCH.active)
+            PREFETCH.pos = 0;
+    }
+    pthread_mutex_unlock(&PREFETCH.lock);
+    clear(in, PREFETCH_BYTES);
+    return NULL;
+}
+
+static int entropy_take(u8 *out)
+{
+    int taken = FALSE;
+
+    pthread_once(&PREFETCH_ONCE, prefetch_once);
+    pthread_mutex_lock(&PREFETCH.lock);
+    prefetch_fork_check();
+    if (!PREFETCH.full[PREFETCH.active] && PREFETCH.full[PREFETCH.active ^ 1])
+    {
+        PREFETCH.active ^= 1;
+        PREFETCH.pos = 0;
+    }
+    if (PREFETCH.full[PREFETCH.active])
+    {
+        u8 *in = PREFETCH.buf[PREFETCH.active] + PREFETCH.pos * RESEED_ENTROPY_LEN;
+
+        memcpy(out, in, RESEED_ENTROPY_LEN);
+        clear(in, RESEED_ENTROPY_LEN);
+        taken = TRUE;
+        if (++PREFETCH.pos == RESEED_PREFETCH)
+        {
+            PREFETCH.full[PREFETCH.active] = FALSE;
+            if (PREFETCH.full[PREFETCH.active ^ 1])
+            {
+                PREFETCH.active ^= 1;
+                PREFETCH.pos = 0;
+            }
+            pthread_cond_signal(&PREFETCH.wake);
+        }
+    }
+    pthread_mutex_unlock(&PREFETCH.lock);
+    return taken || Entropy_Read(NULL, out, RESEED_ENTROPY_LEN);
+}
+
+//! 0 keeps the current value
+void Reseed_Policy(unsigned long long interval, unsigned long long byte_limit)
+{
+    if (interval != 0)
+        atomic_store_explicit(&PREFETCH.interval, interval, memory_order_relaxed);
+    if (byte_limit != 0)
+        atomic_store_explicit(&PREFETCH.byte_limit, byte_limit, memory_order_relaxed);
+}
+
+//! TRUE if serving len more bytes after counter requests and bytes output crosses the policy
+int Reseed_Due(unsigned long long counter, unsigned long long bytes, size_t len)
+{
+    return counter >= atomic_load_explicit(&PREFETCH.interval, memory_order_relaxed) ||
+           bytes + len > atomic_load_explicit(&PREFETCH.byte_limit, memory_order_relaxed);
+}
+
+//! reseed state if serving len more bytes would cross the policy, FALSE if that failed
+int Reseed_Check(st_state *state, size_t len)
+{
+    u8 in[RESEED_ENTROPY_LEN];
+    int ret;
+
+    //! a forked child never outputs from its parent's state
+    if (state->fork_gen != Fork_Generation() && !Fork_Reseed(state))
+        return FALSE;
+    if (!Reseed_Due(state->Reseed_counter, state->Reseed_bytes, len))
+        return TRUE;
+    if (!entropy_take(in))
+        return FALSE;
+    ret = Reseed_Input(state, in, RESEED_ENTROPY_LEN, NULL, 0);
+    clear(in, RESEED_ENTROPY_LEN);
+    return ret;
+}
+
+/*
+*   Prediction resistance: a reseed from a prefetched entropy input before
+*   every request. The caller's re_add_data, when given, is the additional
+*   input of that reseed (RESEED_ADD_DATA_LEN bytes), never its entropy.
+*/
+int Reseed_Prediction(st_state *state, u8 *re_add_data)
+{
+    u8 in[RESEED_ENTROPY_LEN];
+    int ret;
+
+    if (!entropy_take(in))
+        return FALSE;
+    ret = Reseed_Input(state, in, RESEED_ENTROPY_LEN, re_add_data,
+                       re_add_data != NULL ? RESEED_ADD_DATA_LEN : 0);
+    clear(in, RESEED_ENTROPY_LEN);
+    return ret;
+}
+
+int Reseed_Prefetch_Start(void)
+{
+    int ret = TRUE;
+
+    pthread_once(&PREFETCH_ONCE, prefetch_once);
+    pthread_mutex_lock(&PREFETCH.lock);
+    prefetch_fork_check();
+    if (!PREFETCH.running)
+    {
+        PREFETCH.running = TRUE;
+        if (pthread_create(&PREFETCH.thread, NULL, prefetch_main, NULL) != 0)
+        {
+            PREFETCH.running = FALSE;
+            ret = FALSE;
+        }
+    }
+    pthread_mutex_unlock(&PREFETCH.lock);
+    return ret;
+}
+
+void Reseed_Prefetch_Stop(void)
+{
+    pthread_mutex_lock(&PREFETCH.lock);
+    prefetch_fork_check();
+    if (!PREFETCH.running)
+    {
+        pthread_mutex_unlock(&PREFETCH.lock);
+        return;
+    }
+    PREFETCH.running = FALSE;
+    pthread_cond_signal(&PREFETCH.wake);
+    pthread_mutex_unlock(&PREFETCH.lock);
+    pthread_join(PREFETCH.thread, NULL);
+
+    pthread_mutex_lock(&PREFETCH.lock);
+    clear(PREFETCH.buf[0], sizeof(PREFETCH.buf));
+    PREFETCH.full[0] = FALSE;
+    PREFETCH.full[1] = FALSE;
+    PREFETCH.pos = 0;
+    pthread_mutex_unlock(&PREFETCH.lock);
+}
@@ -0,0 +1,305 @@
+#define _GNU_SOURCE // memfd_create, F_ADD_SEALS
+#include "header.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+*   Shared-memory ring
+*
+*   Every consumer gets a memfd of its own holding RING_SLOTS slots of
+*   RING_SLOT bytes, so a process only ever maps its own bytes; the memfd
+*   is sealed against resizing, a consumer cannot make the producer fault.
+*   Slot s carries a sequence number: pos while free for the fill at ring
+*   position pos, pos + 1 once filled. The producer thread fills free runs
+*   of slots with one generate each from the consumer's own instance (split
+*   off one master). A reader claims the slot at tail with a CAS on tail,
+*   copies it out, erases it and hands it back as pos + RING_SLOTS, so
+*   threads or processes sharing a consumer's memfd never get the same
+*   bytes. A read that finds its bytes filled makes no system call.
+*/
+#define RING_MAGIC 0x52494e47u
+
+typedef struct _RING_SHARED {
+    unsigned int magic;
+    unsigned int slot, slots;
+    _Atomic int closed; // producer gone or failed, no more fills
+    _Atomic unsigned long long tail __attribute__((aligned(CACHE_LINE)));
+    _Atomic unsigned long long seq[RING_SLOTS] __attribute__((aligned(CACHE_LINE)));
+    u8 data[RING_SLOTS][RING_SLOT] __attribute__((aligned(4096)));
+} st_ring_shared;
+
+typedef struct _RING_PART {
+    int fd;
+    st_ring_shared *shm;
+    st_state state;
+    unsigned long long head; // next position to fill
+} st_ring_part;
+
+struct _RING {
+    int consumers;
+    _Atomic int running;
+    pthread_t thread;
+    st_ring_part part[RING_CONSUMERS];
+};
+
+struct _RING_READER {
+    st_ring_shared *shm;
+    u8 rest[RING_SLOT]; // unread part of the last slot
+    size_t pos;         // RING_SLOT when empty
+};
+
+//! fill the free run at part->head, up to the wrap; bytes filled, -1 on failure
+static long ring_fill(st_ring_part *part)
+{
+    st_ring_shared *shm = part->shm;
+    unsigned long long pos = part->head;
+    size_t first = (size_t)(pos % RING_SLOTS), n = 0;
+
+    while (first + n < RING_SLOTS &&
+           atomic_load_explicit(&shm->seq[first + n], memory_order_acquire) == pos + n)
+        n++;
+    if (n == 0)
+        return 0;
+    if (!generate_Bytes(&part->state, shm->data[first], n * RING_SLOT, NULL))
+        return -1;
+    for (size_t cnt_i = 0; cnt_i < n; cnt_i++)
+    {
+        atomic_store_explicit(&shm->seq[first + cnt_i], pos + cnt_i + 1, memory_order_release);
+    }
+    part->head = pos + n;
+    return (long)(n * RING_SLOT);
+}
+
+static void *ring_main(void *arg)
+{
+    st_ring *ring = (st_ring *)arg;
+
+    while (atomic_load(&ring->running))
+    {
+        long filled = 0;
+
+        for (int cnt_i = 0; cnt_i < ring->consumers; cnt_i++)
+        {
+            st_ring_part *part = &ring->part[cnt_i];
+            long n;
+
+            if (atomic_load(&part->shm->closed))
+                continue;
+            n = ring_fill(part);
+            //! no entropy for a due reseed: readers drain what is there, then fail
+            if (n < 0)
+                atomic_store(&part->shm->closed, TRUE);
+            else
+                filled += n;
+        }
+        if (filled == 0)
+            usleep(RING_NAP_US);
+    }
+    return NULL;
+}
+
+static void ring_part_free(st_ring_part *part)
+{
+    if (part->shm != NULL)
+    {
+        atomic_store(&part->shm->closed, TRUE);
+        munmap(part->shm, sizeof(st_ring_shared));
+    }
+    if (part->fd >= 0)
+        close(part->fd);
+    clear((u8 *)&part->state, sizeof(st_state));
+}
+
+/*
+*   A ring for consumers readers, filled by a producer thread until
+*   DRBG_Ring_Free. Hand consumer i the fd of DRBG_Ring_Fd(ring, i), by
+*   fork, or over a Unix socket with SCM_RIGHTS; it is close-on-exec.
+*/
+st_ring *DRBG_Ring_New(int consumers)
+{
+    st_ring *ring;
+    st_state master;
+    u8 in[INSTANCE_INPUT];
+
+    if (consumers < 1 || consumers > RING_CONSUMERS)
+        return NULL;
+    ring = (st_ring *)Secure_Alloc(sizeof(st_ring), 0);
+    if (ring == NULL)
+        return NULL;
+    for (int cnt_i = 0; cnt_i < RING_CONSUMERS; cnt_i++)
+        ring->part[cnt_i].fd = -1;
+    if (!Entropy_Read(NULL, in, INSTANCE_INPUT))
+    {
+        Secure_Free(ring);
+        return NULL;
+    }
+    Instantiate(&master, in);
+    clear(in, INSTANCE_INPUT);
+
+    ring->consumers = consumers;
+    for (int cnt_i = 0; cnt_i < consumers; cnt_i++)
+    {
+        st_ring_part *part = &ring->part[cnt_i];
+        void *map;
+
+        part->fd = memfd_create("ctrdrbg-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (part->fd < 0 || ftruncate(part->fd, sizeof(st_ring_shared)) != 0 ||
+            fcntl(part->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0 ||
+            (map = mmap(NULL, sizeof(st_ring_shared), PROT_READ | PROT_WRITE, MAP_SHARED, part->fd, 0)) == MAP_FAILED ||
+            !DRBG_Split(&master, &part->state))
+        {
+            clear((u8 *)&master, sizeof(st_state));
+            DRBG_Ring_Free(ring);
+            return NULL;
+        }
+        part->shm = (st_ring_shared *)map;
+        part->shm->magic = RING_MAGIC;
+        part->shm->slot = RING_SLOT;
+        part->shm->slots = RING_SLOTS;
+        for (int cnt_j = 0; cnt_j < RING_SLOTS; cnt_j++)
+            atomic_init(&part->shm->seq[cnt_j], (unsigned long long)cnt_j);
+        //! first fill here, a reader attaching at once finds bytes
+        if (ring_fill(part) < 0)
+            atomic_store(&part->shm->closed, TRUE);
+    }
+    clear((u8 *)&master, sizeof(st_state));
+
+    atomic_store(&ring->running, TRUE);
+    if (pthread_create(&ring->thread, NULL, ring_main, ring) != 0)
+    {
+        atomic_store(&ring->running, FALSE);
+        DRBG_Ring_Free(ring);
+        return NULL;
+    }
+    return ring;
+}
+
+int DRBG_Ring_Fd(st_ring *ring, int consumer)
+{
+    if (consumer < 0 || consumer >= ring->consumers)
+        return -1;
+    return ring->part[consumer].fd;
+}
+
+//! readers still attached get what was filled, then FALSE
+void DRBG_Ring_Free(st_ring *ring)
+{
+    if (ring == NULL)
+        return;
+    if (atomic_exchange(&ring->running, FALSE))
+        pthread_join(ring->thread, NULL);
+    for (int cnt_i = 0; cnt_i < RING_CONSUMERS; cnt_i++)
+        ring_part_free(&ring->part[cnt_i]);
+    Secure_Free(ring);
+}
+
+/*
+*   Reader side, in the consumer. A reader is for one thread; threads of
+*   one consumer each attach their own on the same fd. The fd may be
+*   closed after attaching.
+*/
+st_ring_reader *DRBG_Ring_Attach(int fd)
+{
+    st_ring_reader *reader;
+    struct stat st;
+    void *map;
+
+    if (fstat(fd, &st) != 0 || st.st_size != (off_t)sizeof(st_ring_shared))
+        return NULL;
+    map = mmap(NULL, sizeof(st_ring_shared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        return NULL;
+    reader = (st_ring_reader *)Secure_Alloc(sizeof(st_ring_reader), 0);
+    if (reader == NULL || ((st_ring_shared *)map)->magic != RING_MAGIC ||
+        ((st_ring_shared *)map)->slot != RING_SLOT || ((st_ring_shared *)map)->slots != RING_SLOTS)
+    {
+        Secure_Free(reader);
+        munmap(map, sizeof(st_ring_shared));
+        return NULL;
+    }
+    reader->shm = (st_ring_shared *)map;
+    reader->pos = RING_SLOT;
+    return reader;
+}
+
+//! claim the next filled slot, copy it to out and erase it; FALSE once closed and drained
+static int ring_take(st_ring_shared *shm, u8 *out)
+{
+    unsigned long long pos = atomic_load_explicit(&shm->tail, memory_order_relaxed);
+    int spins = 0;
+
+    for (;;)
+    {
+        size_t s = (size_t)(pos % RING_SLOTS);
+        unsigned long long seq = atomic_load_explicit(&shm->seq[s], memory_order_acquire);
+
+        if (seq == pos + 1)
+        {
+            if (atomic_compare_exchange_weak_explicit(&shm->tail, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+            {
+                memcpy(out, shm->data[s], RING_SLOT);
+                memset(shm->data[s], 0, RING_SLOT);
+                atomic_store_explicit(&shm->seq[s], pos + RING_SLOTS, memory_order_release);
+                return TRUE;
+            }
+            continue;
+        }
+        if (seq > pos + 1)
+        {
+            //! another reader took it
+            pos = atomic_load_explicit(&shm->tail, memory_order_relaxed);
+            continue;
+        }
+        //! empty: the producer is behind, or gone
+        if (atomic_load(&shm->closed))
+            return FALSE;
+        if (++spins > 64)
+            sched_yield();
+        pos = atomic_load_explicit(&shm->tail, memory_order_relaxed);
+    }
+}
+
+int DRBG_Ring_Read(st_ring_reader *reader, u8 *out, size_t len)
+{
+    while (len > 0)
+    {
+        size_t n;
+
+        if (len >= RING_SLOT && reader->pos == RING_SLOT)
+        {
+            //! whole slots straight into out
+            if (!ring_take(reader->shm, out))
+                return FALSE;
+            out += RING_SLOT;
+            len -= RING_SLOT;
+            continue;
+        }
+        if (reader->pos == RING_SLOT)
+        {
+            if (!ring_take(reader->shm, reader->rest))
+                return FALSE;
+            reader->pos = 0;
+        }
+        n = RING_SLOT - reader->pos < len ? RING_SLOT - reader->pos : len;
+        memcpy(out, reader->rest + reader->pos, n);
+        memset(reader->rest + reader->pos, 0, n);
+        reader->pos += n;
+        out += n;
+        len -= n;
+    }
+    return TRUE;
+}
+
+void DRBG_Ring_Detach(st_ring_reader *reader)
+{
+    if (reader == NULL)
+        return;
+    munmap(reader->shm, sizeof(st_ring_shared));
+    Secure_Free(reader);
+}
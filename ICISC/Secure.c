@@ -0,0 +1,309 @@
+#include "header.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+/*
+*   Secure memory
+*
+*   A region is a PROT_NONE reservation with the usable bytes in the middle,
+*   so at least one inaccessible page sits on either side of it. The usable
+*   bytes are mlocked, which also faults them in, and left out of core
+*   dumps; where RLIMIT_MEMLOCK refuses the lock they are touched once
+*   instead, the generate path still takes no page fault on them.
+*
+*   Allocations below SECURE_LARGE are runs of SECURE_CHUNK chunks in a
+*   shared region of SECURE_REGION bytes, one set of regions per flags
+*   value and node, with a bitmap of used chunks and the run length at the
+*   first chunk kept outside the region. Every chunk below hint is in use.
+*   Larger allocations are a region of their own, with SECURE_HUGE on 2 MiB
+*   pages from hugetlbfs if some are reserved, else transparent huge pages.
+*/
+#define SECURE_PAGE 4096
+#define SECURE_WORD(i) ((i) / 64)
+#define SECURE_BIT(i) (1ULL << ((i) % 64))
+
+typedef struct _SECURE_REGION {
+    u8 *base;            // reservation, guard pages included
+    size_t total;
+    u8 *mem;             // len usable bytes
+    size_t len;
+    unsigned int flags;
+    int node;            // -1: first touch
+    int locked;
+    unsigned long long *used; // one bit per chunk, NULL for a large allocation
+    unsigned int *run;        // chunks of the allocation starting at a chunk
+    size_t chunks, hint;
+    struct _SECURE_REGION *next;
+} st_secure_region;
+
+static struct {
+    pthread_mutex_t lock;
+    st_secure_region *list;
+    size_t locked, unlocked;
+} SECURE = {PTHREAD_MUTEX_INITIALIZER};
+
+static pthread_once_t SECURE_ONCE = PTHREAD_ONCE_INIT;
+
+//! a forked child is alone, the lock may have been held by a parent thread
+static void secure_child(void)
+{
+    pthread_mutex_init(&SECURE.lock, NULL);
+}
+
+static void secure_init(void)
+{
+    pthread_atfork(NULL, NULL, secure_child);
+}
+
+static void secure_zero(u8 *ptr, size_t len)
+{
+    while (len > 0)
+    {
+        int n = len > (1u << 30) ? (1 << 30) : (int)len;
+
+        clear(ptr, n);
+        ptr += n;
+        len -= (size_t)n;
+    }
+}
+
+static st_secure_region *region_new(size_t len, unsigned int flags, int node)
+{
+    size_t align = (flags & SECURE_HUGE) ? SECURE_HUGE_PAGE : SECURE_PAGE;
+    st_secure_region *r = (st_secure_region *)calloc(1, sizeof(st_secure_region));
+    void *base;
+    int mapped = FALSE;
+
+    if (r == NULL)
+        return NULL;
+    r->len = (len + align - 1) & ~(align - 1);
+    r->total = r->len + 2 * align;
+    base = mmap(NULL, r->total, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED)
+    {
+        free(r);
+        return NULL;
+    }
+    r->base = (u8 *)base;
+    r->mem = (u8 *)(((uintptr_t)base + SECURE_PAGE + align - 1) & ~(uintptr_t)(align - 1));
+    r->flags = flags;
+    r->node = node;
+
+#if defined(MAP_HUGETLB) && defined(MAP_FIXED_NOREPLACE)
+    if (flags & SECURE_HUGE)
+    {
+        void *p = mmap(r->mem, r->len, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_HUGETLB, -1, 0);
+
+        mapped = p != MAP_FAILED;
+        //! a failed MAP_FIXED may have unmapped the reservation under it already
+        if (!mapped)
+        {
+            p = mmap(r->mem, r->len, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+            if (p != MAP_FAILED && p != (void *)r->mem)
+                munmap(p, r->len);
+            if (p == (void *)r->mem)
+                madvise(r->mem, r->len, MADV_HUGEPAGE);
+            mapped = p == (void *)r->mem;
+        }
+    }
+#endif
+    if (!mapped)
+    {
+        if (mprotect(r->mem, r->len, PROT_READ | PROT_WRITE) != 0)
+        {
+            munmap(base, r->total);
+            free(r);
+            return NULL;
+        }
+#if defined(MADV_HUGEPAGE)
+        if (flags & SECURE_HUGE)
+            madvise(r->mem, r->len, MADV_HUGEPAGE);
+#endif
+    }
+#if defined(MADV_DONTDUMP)
+    madvise(r->mem, r->len, MADV_DONTDUMP);
+#endif
+    if (flags & SECURE_WIPE)
+        Fork_Wipe(r->mem, r->len);
+    //! before the lock faults the pages in
+    if (node >= 0)
+        Numa_Bind(r->mem, r->len, node);
+
+    r->locked = mlock(r->mem, r->len) == 0;
+    if (r->locked)
+    {
+        SECURE.locked += r->len;
+    }
+    else
+    {
+        for (size_t cnt_i = 0; cnt_i < r->len; cnt_i += SECURE_PAGE)
+            ((volatile u8 *)r->mem)[cnt_i] = 0;
+        SECURE.unlocked += r->len;
+    }
+    return r;
+}
+
+static void region_free(st_secure_region *r)
+{
+    if (r->locked)
+    {
+        munlock(r->mem, r->len);
+        SECURE.locked -= r->len;
+    }
+    else
+    {
+        SECURE.unlocked -= r->len;
+    }
+    munmap(r->base, r->total);
+    free(r->used);
+    free(r->run);
+    free(r);
+}
+
+static st_secure_region *region_small(unsigned int flags, int node)
+{
+    st_secure_region *r = region_new(SECURE_REGION, flags, node);
+
+    if (r == NULL)
+        return NULL;
+    r->chunks = r->len / SECURE_CHUNK;
+    r->used = (unsigned long long *)calloc((r->chunks + 63) / 64, sizeof(unsigned long long));
+    r->run = (unsigned int *)calloc(r->chunks, sizeof(unsigned int));
+    if (r->used == NULL || r->run == NULL)
+    {
+        region_free(r);
+        return NULL;
+    }
+    return r;
+}
+
+//! first fit of n chunks at or above hint, NULL if the region has no such run
+static u8 *region_take(st_secure_region *r, size_t n)
+{
+    size_t start = r->hint, found = 0;
+
+    for (size_t cnt_i = r->hint; cnt_i < r->chunks; cnt_i++)
+    {
+        if (cnt_i % 64 == 0 && r->used[SECURE_WORD(cnt_i)] == ~0ULL)
+        {
+            cnt_i += 63;
+            start = cnt_i + 1;
+            found = 0;
+            continue;
+        }
+        if (r->used[SECURE_WORD(cnt_i)] & SECURE_BIT(cnt_i))
+        {
+            start = cnt_i + 1;
+            found = 0;
+            continue;
+        }
+        if (++found < n)
+            continue;
+        for (size_t cnt_j = start; cnt_j < start + n; cnt_j++)
+            r->used[SECURE_WORD(cnt_j)] |= SECURE_BIT(cnt_j);
+        r->run[start] = (unsigned int)n;
+        if (start == r->hint)
+            r->hint = start + n;
+        return r->mem + start * SECURE_CHUNK;
+    }
+    return NULL;
+}
+
+/*
+*   len zeroed bytes aligned to CACHE_LINE (a page from SECURE_LARGE on),
+*   NULL when no memory can be mapped. flags: SECURE_WIPE, SECURE_HUGE.
+*/
+void *Secure_Alloc(size_t len, unsigned int flags)
+{
+    return Secure_Alloc_Node(len, flags, -1);
+}
+
+//! the same on NUMA node node, where the kernel has room for it
+void *Secure_Alloc_Node(size_t len, unsigned int flags, int node)
+{
+    st_secure_region *r;
+    u8 *ptr = NULL;
+
+    if (len == 0)
+        return NULL;
+    pthread_once(&SECURE_ONCE, secure_init);
+    pthread_mutex_lock(&SECURE.lock);
+    if (len >= SECURE_LARGE)
+    {
+        //! a huge page for less than half its size wastes more than it saves
+        if (len < SECURE_HUGE_PAGE / 2)
+            flags &= ~(unsigned int)SECURE_HUGE;
+        r = region_new(len, flags, node);
+        if (r != NULL)
+        {
+            r->next = SECURE.list;
+            SECURE.list = r;
+            ptr = r->mem;
+        }
+        pthread_mutex_unlock(&SECURE.lock);
+        return ptr;
+    }
+
+    flags &= ~(unsigned int)SECURE_HUGE;
+    for (r = SECURE.list; r != NULL && ptr == NULL; r = r->next)
+    {
+        if (r->used != NULL && r->flags == flags && r->node == node)
+            ptr = region_take(r, (len + SECURE_CHUNK - 1) / SECURE_CHUNK);
+    }
+    if (ptr == NULL && (r = region_small(flags, node)) != NULL)
+    {
+        r->next = SECURE.list;
+        SECURE.list = r;
+        ptr = region_take(r, (len + SECURE_CHUNK - 1) / SECURE_CHUNK);
+    }
+    pthread_mutex_unlock(&SECURE.lock);
+    return ptr;
+}
+
+//! zeroizes before release; NULL and pointers not from Secure_Alloc are ignored
+void Secure_Free(void *ptr)
+{
+    st_secure_region **link;
+    u8 *p = (u8 *)ptr;
+
+    if (ptr == NULL)
+        return;
+    pthread_mutex_lock(&SECURE.lock);
+    for (link = &SECURE.list; *link != NULL; link = &(*link)->next)
+    {
+        st_secure_region *r = *link;
+        size_t first, n;
+
+        if (p < r->mem || p >= r->mem + r->len)
+            continue;
+        if (r->used == NULL)
+        {
+            *link = r->next;
+            secure_zero(r->mem, r->len);
+            region_free(r);
+            break;
+        }
+        first = (size_t)(p - r->mem) / SECURE_CHUNK;
+        n = r->run[first];
+        secure_zero(r->mem + first * SECURE_CHUNK, n * SECURE_CHUNK);
+        for (size_t cnt_i = first; cnt_i < first + n; cnt_i++)
+            r->used[SECURE_WORD(cnt_i)] &= ~SECURE_BIT(cnt_i);
+        r->run[first] = 0;
+        if (first < r->hint)
+            r->hint = first;
+        break;
+    }
+    pthread_mutex_unlock(&SECURE.lock);
+}
+
+//! bytes mapped for secure memory, mlocked and not (RLIMIT_MEMLOCK)
+void Secure_Stats(size_t *locked, size_t *unlocked)
+{
+    pthread_mutex_lock(&SECURE.lock);
+    *locked = SECURE.locked;
+    *unlocked = SECURE.unlocked;
+    pthread_mutex_unlock(&SECURE.lock);
+}
@@ -0,0 +1,292 @@
+#include "header.h"
+#include <stdatomic.h>
+#include <sched.h>
+
+/*
+*   Shared instance
+*
+*   CTR output inside one request is E(K, V+1) .. E(K, V+n), so callers can
+*   take disjoint block ranges of the current epoch with one fetch_add and
+*   encrypt them in parallel. Epoch e covers the request V_e+1 .. V_e+EPOCH_BLOCKS,
+*   its successor is the update run on (K_e, V_e + EPOCH_BLOCKS) exactly as
+*   generate_Bytes would run it, so the stream equals a serial sequence of
+*   MAX_REQUEST_LEN generate requests.
+*
+*   Epochs live in EPOCH_SLOTS fixed slots that are never freed, so a reader
+*   may touch a stale slot's refs safely; it re-checks current after taking
+*   its reference. The rotating thread publishes the next epoch, waits for
+*   readers of the old one to drain, zeroizes it and only then frees the slot.
+*
+*   Only the reservation is lock-free. Rotation, once per EPOCH_BLOCKS
+*   blocks, is a spin lock on the old epoch's rotating flag: callers that
+*   run off the end of the epoch yield until the winner publishes the next
+*   one, and the winner yields until the old epoch's readers are gone, so a
+*   winner that is descheduled (or slot reuse after a fast wrap) stalls
+*   every caller that needs the next epoch.
+*
+*   Every epoch is one request under the reseed policy. The rotating thread
+*   reseeds the next epoch when the policy asks for it; without entropy it
+*   publishes that epoch exhausted and marked failed, callers that find it
+*   so retry the rotation once and return FALSE if it fails again.
+*
+*   The instance is SECURE_WIPE secure memory. In a forked child
+*   the first caller reinstantiates it from fresh entropy while the others
+*   wait; the epochs and references of the parent's threads are dropped.
+*/
+typedef struct _EPOCH {
+    u8 round_key[ROUND_KEY_LEN];
+    u8 key[KEY_SIZE];
+    u8 V[BLOCK_SIZE]; // counter before the first block of the epoch
+    int R;
+    _Atomic unsigned long long next; // first unreserved block
+    _Atomic unsigned int refs;
+    _Atomic int rotating;
+    _Atomic int busy; // live, or retired but not yet drained
+    _Atomic int failed; // a reseed was due and had no entropy
+} __attribute__((aligned(CACHE_LINE))) st_epoch;
+
+struct _SHARED_DRBG {
+    st_epoch slot[EPOCH_SLOTS];
+    _Atomic unsigned int current;
+    unsigned long long reseed_counter, reseed_bytes; // rotating thread only
+    _Atomic unsigned long fork_gen;
+    _Atomic int forking;
+} __attribute__((aligned(CACHE_LINE)));
+
+static void epoch_key(st_epoch *epoch)
+{
+    epoch->R = Kernel()->key_setup(epoch->key, epoch->round_key, KEY_BIT);
+    atomic_store(&epoch->next, 0);
+    atomic_store(&epoch->rotating, FALSE);
+    atomic_store(&epoch->failed, FALSE);
+}
+
+//! the reseed policy ahead of epoch, FALSE if a reseed was due and failed
+static int epoch_policy(st_shared_drbg *drbg, st_epoch *epoch)
+{
+    st_state state;
+    int ok;
+
+    drbg->reseed_counter++;
+    drbg->reseed_bytes += EPOCH_BLOCKS * BLOCK_SIZE;
+    if (!Reseed_Due(drbg->reseed_counter, drbg->reseed_bytes, EPOCH_BLOCKS * BLOCK_SIZE))
+        return TRUE;
+    memcpy(state.key, epoch->key, KEY_SIZE);
+    memcpy(state.V, epoch->V, BLOCK_SIZE);
+    state.Reseed_counter = drbg->reseed_counter;
+    state.Reseed_bytes = drbg->reseed_bytes;
+    state.prediction_flag = FALSE;
+    state.fork_gen = Fork_Generation();
+    ok = Reseed_Check(&state, EPOCH_BLOCKS * BLOCK_SIZE);
+    if (ok)
+    {
+        memcpy(epoch->key, state.key, KEY_SIZE);
+        memcpy(epoch->V, state.V, BLOCK_SIZE);
+        drbg->reseed_counter = state.Reseed_counter;
+        drbg->reseed_bytes = state.Reseed_bytes;
+        epoch_key(epoch);
+    }
+    clear((u8 *)&state, sizeof(st_state));
+    return ok;
+}
+
+//! update after an EPOCH_BLOCKS request, same convention as generate_Bytes
+static void epoch_next(const st_epoch *old, st_epoch *epoch)
+{
+    u8 V[BLOCK_SIZE], seed[SEED_LEN], temp[SEED_LEN];
+
+    memcpy(V, old->V, BLOCK_SIZE);
+    Counter_Add(V, EPOCH_BLOCKS);
+    memcpy(seed, old->key, KEY_SIZE);
+    memcpy(seed + KEY_SIZE, V, BLOCK_SIZE);
+    Kernel()->ctr(old->round_key, old->R, V, temp, LEN_SEED);
+    for (int cnt_i = 0; cnt_i < KEY_SIZE; cnt_i++)
+    {
+        epoch->key[cnt_i] = temp[cnt_i] ^ seed[cnt_i];
+    }
+    for (int cnt_i = 0; cnt_i < BLOCK_SIZE; cnt_i++)
+    {
+        epoch->V[cnt_i] = temp[KEY_SIZE + cnt_i] ^ seed[KEY_SIZE + cnt_i];
+    }
+    clear(seed, SEED_LEN);
+    clear(temp, SEED_LEN);
+    epoch_key(epoch);
+}
+
+static st_epoch *epoch_acquire(st_shared_drbg *drbg, unsigned int *index)
+{
+    for (;;)
+    {
+        unsigned int cur = atomic_load(&drbg->current);
+        st_epoch *epoch = &drbg->slot[cur];
+
+        atomic_fetch_add(&epoch->refs, 1);
+        if (atomic_load(&drbg->current) == cur)
+        {
+            *index = cur;
+            return epoch;
+        }
+        atomic_fetch_sub(&epoch->refs, 1);
+    }
+}
+
+/*
+*   Called with a reference on the exhausted epoch. One thread wins the
+*   rotation, the others wait for current to move on.
+*/
+static void epoch_rotate(st_shared_drbg *drbg, unsigned int cur)
+{
+    st_epoch *old = &drbg->slot[cur];
+    unsigned int nxt = (cur + 1) % EPOCH_SLOTS;
+    int expected = FALSE;
+
+    if (!atomic_compare_exchange_strong(&old->rotating, &expected, TRUE))
+    {
+        while (atomic_load(&drbg->current) == cur)
+            sched_yield();
+        return;
+    }
+
+    //! slot nxt may still be draining after a fast wrap of the ring
+    while (atomic_load(&drbg->slot[nxt].busy))
+        sched_yield();
+    atomic_store(&drbg->slot[nxt].busy, TRUE);
+    epoch_next(old, &drbg->slot[nxt]);
+    if (!epoch_policy(drbg, &drbg->slot[nxt]))
+    {
+        atomic_store(&drbg->slot[nxt].next, EPOCH_BLOCKS);
+        atomic_store(&drbg->slot[nxt].failed, TRUE);
+    }
+    atomic_store(&drbg->current, nxt);
+
+    //! our own reference is the 1 left
+    while (atomic_load(&old->refs) > 1)
+        sched_yield();
+    clear(old->round_key, ROUND_KEY_LEN);
+    clear(old->key, KEY_SIZE);
+    clear(old->V, BLOCK_SIZE);
+    atomic_store(&old->busy, FALSE);
+}
+
+//! epoch 0 of a fresh instance in an otherwise zero slot ring
+static void shared_seed(st_shared_drbg *drbg, u8 *in)
+{
+    st_state state;
+
+    Instantiate(&state, in);
+    memcpy(drbg->slot[0].key, state.key, KEY_SIZE);
+    memcpy(drbg->slot[0].V, state.V, BLOCK_SIZE);
+    clear((u8 *)&state, sizeof(st_state));
+    epoch_key(&drbg->slot[0]);
+    atomic_store(&drbg->slot[0].busy, TRUE);
+    atomic_store(&drbg->current, 0);
+    drbg->reseed_counter = 0;
+    drbg->reseed_bytes = 0;
+    atomic_store(&drbg->fork_gen, Fork_Generation());
+}
+
+//! first caller in a forked child reinstantiates, FALSE without entropy
+static int shared_fork(st_shared_drbg *drbg, unsigned long gen)
+{
+    u8 in[INSTANCE_INPUT];
+    int expected = FALSE, ok;
+
+    if (!atomic_compare_exchange_strong(&drbg->forking, &expected, TRUE))
+    {
+        while (atomic_load(&drbg->forking))
+            sched_yield();
+        return atomic_load(&drbg->fork_gen) == gen;
+    }
+    //! another caller may have finished in the meantime
+    if (atomic_load(&drbg->fork_gen) == gen)
+    {
+        atomic_store(&drbg->forking, FALSE);
+        return TRUE;
+    }
+    ok = Entropy_Read(NULL, in, INSTANCE_INPUT);
+    if (ok)
+    {
+        clear((u8 *)drbg->slot, sizeof(drbg->slot));
+        shared_seed(drbg, in);
+        clear(in, INSTANCE_INPUT);
+    }
+    atomic_store(&drbg->forking, FALSE);
+    return ok;
+}
+
+st_shared_drbg *DRBG_Shared_New(u8 *in)
+{
+    st_shared_drbg *drbg = (st_shared_drbg *)Secure_Alloc(sizeof(st_shared_drbg), SECURE_WIPE);
+
+    if (drbg == NULL)
+        return NULL;
+    shared_seed(drbg, in);
+    return drbg;
+}
+
+int DRBG_Shared_Generate(st_shared_drbg *drbg, u8 *random, size_t len)
+{
+    const st_kernel *kernel = Kernel();
+    unsigned long gen = Fork_Generation();
+    u8 last[BLOCK_SIZE];
+
+    if (atomic_load_explicit(&drbg->fork_gen, memory_order_acquire) != gen && !shared_fork(drbg, gen))
+        return FALSE;
+    while (len > 0)
+    {
+        unsigned int cur;
+        st_epoch *epoch = epoch_acquire(drbg, &cur);
+        size_t blocks = (len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        unsigned long long start, end;
+
+        if (blocks > EPOCH_BLOCKS)
+            blocks = EPOCH_BLOCKS;
+        start = atomic_fetch_add(&epoch->next, blocks);
+        end = start + blocks;
+        if (end > EPOCH_BLOCKS)
+            end = EPOCH_BLOCKS;
+
+        if (start >= end && atomic_load(&epoch->failed))
+        {
+            int failed;
+
+            epoch_rotate(drbg, cur);
+            atomic_fetch_sub(&epoch->refs, 1);
+            epoch = epoch_acquire(drbg, &cur);
+            failed = atomic_load(&epoch->failed);
+            atomic_fetch_sub(&epoch->refs, 1);
+            if (failed)
+                return FALSE;
+            continue;
+        }
+        if (start < end)
+        {
+            u8 V[BLOCK_SIZE];
+            size_t n = (size_t)(end - start);
+            size_t bytes = n * BLOCK_SIZE < len ? n * BLOCK_SIZE : len;
+
+            memcpy(V, epoch->V, BLOCK_SIZE);
+            Counter_Add(V, (size_t)start);
+            kernel->ctr(epoch->round_key, epoch->R, V, random, bytes / BLOCK_SIZE);
+            if (bytes % BLOCK_SIZE != 0)
+            {
+                kernel->ctr(epoch->round_key, epoch->R, V, last, 1);
+                memcpy(random + bytes - bytes % BLOCK_SIZE, last, bytes % BLOCK_SIZE);
+                clear(last, BLOCK_SIZE);
+            }
+            random += bytes;
+            len -= bytes;
+        }
+        if (end == EPOCH_BLOCKS)
+            epoch_rotate(drbg, cur);
+        atomic_fetch_sub(&epoch->refs, 1);
+    }
+    return TRUE;
+}
+
+void DRBG_Shared_Free(st_shared_drbg *drbg)
+{
+    if (drbg == NULL)
+        return;
+    Secure_Free(drbg);
+}
@@ -0,0 +1,50 @@
+#include "header.h"
+#include <pthread.h>
+
+/*
+*   Split
+*
+*   The child is instantiated without the derivation function (SP 800-90A
+*   10.2.1.3.1): seed_material is SEED_LEN bytes generated by the parent,
+*   and the update runs on the all-zero state. That update's keystream is
+*   the same for every child, so it is computed once and a split costs one
+*   parent generate of SEED_LEN bytes plus a XOR.
+*/
+static u8 ZERO_KEYSTREAM[SEED_LEN];
+static pthread_once_t ZERO_ONCE = PTHREAD_ONCE_INIT;
+
+static void zero_keystream(void)
+{
+    const st_kernel *kernel = Kernel();
+    u8 key[KEY_SIZE] = {0x00};
+    u8 V[BLOCK_SIZE] = {0x00};
+    u8 round_key[ROUND_KEY_LEN];
+
+    kernel->ctr(round_key, kernel->key_setup(key, round_key, KEY_BIT), V, ZERO_KEYSTREAM, LEN_SEED);
+}
+
+//! child may not be parent; FALSE (child cleared) if the parent's generate failed
+int DRBG_Split(st_state *parent, st_state *child)
+{
+    u8 seed[SEED_LEN];
+
+    pthread_once(&ZERO_ONCE, zero_keystream);
+    clear((u8 *)child, sizeof(st_state));
+    if (!generate_Bytes(parent, seed, SEED_LEN, NULL))
+    {
+        clear(seed, SEED_LEN);
+        return FALSE;
+    }
+    for (int cnt_i = 0; cnt_i < KEY_SIZE; cnt_i++)
+    {
+        child->key[cnt_i] = ZERO_KEYSTREAM[cnt_i] ^ seed[cnt_i];
+    }
+    for (int cnt_i = 0; cnt_i < BLOCK_SIZE; cnt_i++)
+    {
+        child->V[cnt_i] = ZERO_KEYSTREAM[KEY_SIZE + cnt_i] ^ seed[KEY_SIZE + cnt_i];
+    }
+    child->prediction_flag = parent->prediction_flag;
+    child->fork_gen = parent->fork_gen;
+    clear(seed, SEED_LEN);
+    return TRUE;
+}
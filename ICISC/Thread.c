@@ -0,0 +1,158 @@
+#include "header.h"
+#include <pthread.h>
+
+/*
+*   Per-thread DRBG instances
+*   The master instance only seeds and reseeds thread instances; generate
+*   never touches it, so there is no lock and no shared line on the hot path.
+*   Thread instances live in secure memory on the NUMA node their thread
+*   first asked on and never move, so a DRBG_Thread_State pointer stays
+*   valid; the masters of nodes other than 0 are split off node 0's. A
+*   reseed draws from the master of the node the thread runs on then.
+*/
+typedef struct _THREAD_DRBG {
+    st_state state;
+    unsigned int generates; // since the last reseed from the master
+} __attribute__((aligned(CACHE_LINE))) st_thread_drbg;
+
+typedef struct _THREAD_MASTER {
+    pthread_mutex_t lock;
+    st_state state;
+    int ready;
+} __attribute__((aligned(CACHE_LINE))) st_thread_master;
+
+static st_thread_master *MASTER[NUMA_NODES];
+static int MASTER_NODES;
+
+static __thread st_thread_drbg *LOCAL = NULL;
+static pthread_key_t LOCAL_KEY;
+static pthread_once_t LOCAL_ONCE = PTHREAD_ONCE_INIT;
+
+static void local_free(void *ptr)
+{
+    Secure_Free(ptr);
+}
+
+//! a forked child is alone, the locks may have been held by parent threads
+static void master_child(void)
+{
+    for (int cnt_i = 0; cnt_i < MASTER_NODES; cnt_i++)
+        pthread_mutex_init(&MASTER[cnt_i]->lock, NULL);
+}
+
+static void local_key(void)
+{
+    int nodes = Numa_Nodes();
+
+    //! a node without its own master uses node 0's
+    for (MASTER_NODES = 0; MASTER_NODES < nodes; MASTER_NODES++)
+    {
+        st_thread_master *m = (st_thread_master *)Secure_Alloc_Node(sizeof(st_thread_master), 0, MASTER_NODES);
+
+        if (m == NULL)
+            break;
+        pthread_mutex_init(&m->lock, NULL);
+        MASTER[MASTER_NODES] = m;
+    }
+    pthread_key_create(&LOCAL_KEY, local_free);
+    pthread_atfork(NULL, NULL, master_child);
+}
+
+static st_thread_master *master_of(int node)
+{
+    return node < MASTER_NODES ? MASTER[node] : MASTER[0];
+}
+
+static int master_draw(int node, u8 *out, size_t len)
+{
+    st_thread_master *m = master_of(node);
+    int ready;
+
+    if (m == NULL)
+        return FALSE;
+    pthread_mutex_lock(&m->lock);
+    ready = m->ready;
+    if (ready)
+        ready = generate_Bytes(&m->state, out, len, NULL);
+    pthread_mutex_unlock(&m->lock);
+    return ready;
+}
+
+void DRBG_Thread_Init(u8 *in)
+{
+    pthread_once(&LOCAL_ONCE, local_key);
+    if (MASTER_NODES == 0)
+        return;
+    pthread_mutex_lock(&MASTER[0]->lock);
+    Instantiate(&MASTER[0]->state, in);
+    MASTER[0]->ready = TRUE;
+    for (int cnt_i = 1; cnt_i < MASTER_NODES; cnt_i++)
+    {
+        pthread_mutex_lock(&MASTER[cnt_i]->lock);
+        MASTER[cnt_i]->ready = DRBG_Split(&MASTER[0]->state, &MASTER[cnt_i]->state);
+        pthread_mutex_unlock(&MASTER[cnt_i]->lock);
+    }
+    pthread_mutex_unlock(&MASTER[0]->lock);
+}
+
+/*
+*   NULL until DRBG_Thread_Init has seeded the master. The pointer stays
+*   valid until DRBG_Thread_Release or the thread's exit.
+*/
+st_state *DRBG_Thread_State(void)
+{
+    u8 in[INSTANCE_INPUT];
+    int node;
+    void *ptr;
+
+    if (LOCAL != NULL)
+        return &LOCAL->state;
+
+    pthread_once(&LOCAL_ONCE, local_key);
+    node = Numa_Node();
+    ptr = Secure_Alloc_Node(sizeof(st_thread_drbg), 0, node);
+    if (ptr == NULL)
+        return NULL;
+    if (!master_draw(node, in, INSTANCE_INPUT))
+    {
+        Secure_Free(ptr);
+        return NULL;
+    }
+    LOCAL = (st_thread_drbg *)ptr;
+    Instantiate(&LOCAL->state, in);
+    LOCAL->generates = 0;
+    clear(in, INSTANCE_INPUT);
+    pthread_setspecific(LOCAL_KEY, LOCAL);
+    return &LOCAL->state;
+}
+
+int DRBG_Thread_Generate(u8 *random, size_t len)
+{
+    st_state *state = DRBG_Thread_State();
+    u8 in[RESEED_ENTROPY_LEN];
+
+    if (state == NULL)
+        return FALSE;
+    if (LOCAL->generates >= THREAD_RESEED_INTERVAL)
+    {
+        //! a full security strength of master output, as an entropy input
+        if (master_draw(Numa_Node(), in, RESEED_ENTROPY_LEN) &&
+            Reseed_Input(state, in, RESEED_ENTROPY_LEN, NULL, 0))
+            LOCAL->generates = 0;
+        clear(in, RESEED_ENTROPY_LEN);
+    }
+    if (!generate_Bytes(state, random, len, NULL))
+        return FALSE;
+    LOCAL->generates++;
+    return TRUE;
+}
+
+//! zeroize and drop the calling thread's instance (also done at thread exit)
+void DRBG_Thread_Release(void)
+{
+    if (LOCAL == NULL)
+        return;
+    pthread_setspecific(LOCAL_KEY, NULL);
+    local_free(LOCAL);
+    LOCAL = NULL;
+}
@@ -11,6 +11,7 @@
 #include <memory.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>
 
 /*
 *   choose your block Cipher, using flag
@@ -59,16 +60,18 @@
 #define NONCE 10
 #define Personal_String 10
 #define INSTANCE_INPUT (ENTROPHY_LEN + NONCE + Personal_String)
-#define DF_PADDING_LEN ((INSTANCE_INPUT + 25) % BLOCK_SIZE)
+#define DF_PADDING_LEN ((BLOCK_SIZE - (INSTANCE_INPUT + 25) % BLOCK_SIZE) % BLOCK_SIZE)
 #define DF_INPUT_LEN   ((INSTANCE_INPUT + 25) + DF_PADDING_LEN)
 
 #define ADD_DATA_LEN 10 //it must be small then SEEN_LEN
 #define RESEED_ADD_DATA_LEN 10 
-#define RESEED_PADDING_LEN ((RESEED_ADD_DATA_LEN + 25) % BLOCK_SIZE)
-#define RESEED_INPUT_LEN   ((RESEED_ADD_DATA_LEN + 25) + DF_PADDING_LEN)
+#define RESEED_ENTROPY_LEN KEY_SIZE //entropy input per reseed, the security strength
 
 
 #define RANDOM_LEN 128 //(BYTE)
+#define MAX_REQUEST_LEN (1 << 16) //(BYTE) 2^19 bits per generate request
+
+#define ROUND_KEY_LEN (16 * 17)
 
 
 typedef unsigned char u8;
@@ -76,8 +79,10 @@ typedef unsigned char u8;
 typedef struct _IN_state {   
     u8 key[KEY_SIZE];   
     u8 V[BLOCK_SIZE];     
-    u8 Reseed_counter;
+    unsigned long long Reseed_counter; // generate requests since the last reseed
+    unsigned long long Reseed_bytes;   // output bytes since the last reseed
     u8 prediction_flag;
+    unsigned long fork_gen;            // Fork_Generation() at the last (re)seed
 } st_state;
 
 
@@ -91,11 +96,17 @@ void Show_State(st_state *state);
 void Show_Random_number(u8* random);
 
 void derived_function(u8 *input_data,u8* seed);
-void update_first_call_first_call(st_state* state,u8* seed);
+void df_input(const u8 *input_data, u8 *in);
+void update_first_call(st_state* state,u8* seed);
 void update(st_state *state, u8 *seed,u8* add_data);
 void generate_Random(st_state *state, u8 *random, u8 *re_add_data);
 void Reseed_Function(st_state *state,u8* Reseed_AddData);
+int Block_Cipher_df(const u8 *input, size_t len, const u8 *add, size_t add_len, u8 *seed);
+int Reseed_Input(st_state *state, const u8 *entropy, size_t entropy_len, const u8 *add, size_t add_len);
 void Output(st_state *state, u8* random);
+void Output_Bytes(st_state *state, u8 *random, size_t len);
+int generate_Bytes(st_state *state, u8 *random, size_t len, u8 *re_add_data);
+void Instantiate(st_state *state, u8 *in);
 
 void CTR_DRBG(st_state *in_state, u8 *in, u8 *seed, u8 *random, u8 *re_add_data);
 
@@ -110,4 +121,391 @@ void RotXOR(const u8 *s, int n, u8 *t);
 int EncKeySetup(const u8 *w0, u8 *e, int keyBits);
 void Crypt(const u8 *p, int R, const u8 *e, u8 *c);
 
+
+/*
+*   Kernel dispatch
+*   CPU features are probed once, the first kernel of KERNEL_TABLE that the
+*   CPU supports and that passes its known-answer test is bound.
+*   All DRBG functions go through Kernel() instead of calling Crypt directly.
+*/
+#define CPU_SSE2    0x0001
+#define CPU_SSSE3   0x0002
+#define CPU_AESNI   0x0004
+#define CPU_AVX2    0x0008
+#define CPU_GFNI    0x0010
+#define CPU_VAES    0x0020
+#define CPU_AVX512  0x0040 // F + BW + VL, with ZMM state enabled by the OS
+
+typedef struct _KERNEL {
+    const char *name;
+    unsigned int features;
+    int (*key_setup)(const u8 *key, u8 *round_key, int keyBits);
+    void (*ecb)(const u8 *round_key, int R, const u8 *in, u8 *out, size_t blocks);
+    void (*ecb_keys)(const u8 *const *round_key, int R, const u8 *in, u8 *out, size_t blocks); // block i under round_key[i]
+    void (*ctr)(const u8 *round_key, int R, u8 *V, u8 *out, size_t blocks);
+    void (*cbc_mac)(const u8 *round_key, int R, u8 *chain, const u8 *in, size_t blocks);
+    void (*cbc_mac_chains)(const u8 *round_key, int R, u8 *chain, const u8 *const *in, size_t chains, size_t blocks); // chain i over in[i]
+    void (*f_round)(const u8 *ck, int p, u8 *x, size_t blocks); // key schedule FO (p = 0) / FE (p = 1)
+} st_kernel;
+
+extern const st_kernel *KERNEL_TABLE[];
+
+unsigned int CPU_Features(void);
+void Kernel_Init(void);
+const st_kernel *Kernel(void);
+const st_kernel *Kernel_Find(const char *name);
+int Kernel_Check(const st_kernel *kernel);
+int Kernel_Select(const st_kernel *kernel);
+void Counter_Add(u8 *V, size_t n);
+int EncKeySetup_W64(const u8 *w0, u8 *e, int keyBits);
+int EncKeySetup_Batch(const u8 *const *w0, u8 *const *e, int count, int keyBits);
+
+//! SIMD kernels (Kernel_SIMD.c), x86 only
+extern const st_kernel KERNEL_ARIA_AESNI;
+extern const st_kernel KERNEL_ARIA_VAES;
+extern const st_kernel KERNEL_ARIA_GFNI;
+extern const st_kernel KERNEL_ARIA_GFNI512;
+void Kernel_SIMD_Init(void);
+
+/*
+*   Kernel self-tuning
+*   Times every kernel that passes Kernel_Check and binds the fastest.
+*   The winner is cached in a small profile, at a path the caller gives,
+*   keyed by the CPU signature.
+*/
+#define TUNE_BLOCKS 256
+#define TUNE_ROUNDS 16
+
+unsigned int CPU_Signature(void);
+const st_kernel *Kernel_Tune(const char *profile);
+
+
+/*
+*   Per-thread instances
+*   Each thread lazily instantiates its own state from the master instance.
+*   Thread states sit on their own cache lines and the master lock is only
+*   taken to seed or reseed a thread, never on the generate path.
+*/
+#define CACHE_LINE 64
+#define THREAD_RESEED_INTERVAL 128 // generate calls
+
+void DRBG_Thread_Init(u8 *in);
+st_state *DRBG_Thread_State(void);
+int DRBG_Thread_Generate(u8 *random, size_t len);
+void DRBG_Thread_Release(void);
+
+
+/*
+*   Shared instance
+*   One instance for many threads: callers reserve disjoint counter ranges
+*   of the current epoch with an atomic add and encrypt them concurrently.
+*   An epoch is one generate request of EPOCH_BLOCKS blocks; the thread
+*   that exhausts it runs the update and publishes the next one while the
+*   others spin, the only point where callers wait on each other.
+*/
+#define EPOCH_BLOCKS (MAX_REQUEST_LEN / BLOCK_SIZE)
+#define EPOCH_SLOTS 4
+
+typedef struct _SHARED_DRBG st_shared_drbg;
+
+st_shared_drbg *DRBG_Shared_New(u8 *in);
+int DRBG_Shared_Generate(st_shared_drbg *drbg, u8 *random, size_t len);
+void DRBG_Shared_Free(st_shared_drbg *drbg);
+
+
+/*
+*   Output pool
+*   Per-thread ring of pre-generated output in two halves. Small requests
+*   are a copy and a pointer bump, consumed bytes are erased at once.
+*   A drained half is refilled by the refill thread of the pool's NUMA
+*   node when it runs, otherwise by the caller when it reaches that half.
+*/
+#define POOL_SIZE 8192
+#define POOL_HALF (POOL_SIZE / 2)
+
+int DRBG_Pool_Get(u8 *random, size_t len);
+int DRBG_Pool_Start(void);
+void DRBG_Pool_Stop(void);
+void DRBG_Pool_Release(void);
+
+
+/*
+*   Batch generate
+*   Advances many independent states per call. Their counter blocks share
+*   the SIMD lanes through the kernel's ecb_keys, one round key per block.
+*/
+#define BATCH_STATES 16
+#define BATCH_BLOCKS 256
+
+int generate_Batch(st_state **state, int count, u8 **random, size_t len, u8 **re_add_data);
+void Instantiate_Batch(st_state **state, int count, u8 **in);
+
+
+/*
+*   Compact state arena
+*   Instances live in one array of 56-byte records (key, V, 64-bit reseed
+*   counter and byte count, flags). Round keys are only kept for the instances in a bounded
+*   LRU cache of KEY_CACHE_ENTRIES schedules. An arena is not locked, use
+*   one per thread or serialize the calls.
+*/
+#define KEY_CACHE_ENTRIES 1024
+#define ARENA_PREDICTION 0x1
+
+typedef struct _COMPACT_STATE {
+    u8 key[KEY_SIZE];
+    u8 V[BLOCK_SIZE];
+    unsigned long long reseed_counter; // next free index while on the free list
+    unsigned long long reseed_bytes;
+    unsigned int flags;
+    unsigned int cache; // 1 + key cache entry, 0 when not cached
+} st_compact;
+
+typedef struct _ARENA st_arena;
+
+st_arena *Arena_New(size_t capacity, unsigned int cache_entries);
+long Arena_Instantiate(st_arena *arena, u8 *in, unsigned int flags);
+int Arena_Generate(st_arena *arena, long id, u8 *random, size_t len, u8 *re_add_data);
+void Arena_Remove(st_arena *arena, long id);
+void Arena_Stats(const st_arena *arena, unsigned long long *hits, unsigned long long *misses);
+void Arena_Free(st_arena *arena);
+
+
+/*
+*   Reseed policy
+*   generate_Bytes, the arena and the shared instance reseed a state once
+*   it has served RESEED_INTERVAL requests or would pass RESEED_BYTE_LIMIT
+*   output bytes since its last reseed. Prediction resistance reseeds
+*   before every request from a prefetched input, with the caller's
+*   re_add_data as additional input. The prefetch thread keeps two buffers
+*   of entropy inputs ahead of demand, so neither kind of reseed waits on
+*   the entropy source.
+*/
+#define RESEED_INTERVAL   (1ULL << 48) // SP 800-90A maximum for CTR_DRBG
+#define RESEED_BYTE_LIMIT (1ULL << 44)
+#define RESEED_PREFETCH   8            // entropy inputs kept ready
+
+void Reseed_Policy(unsigned long long interval, unsigned long long byte_limit);
+int Reseed_Due(unsigned long long counter, unsigned long long bytes, size_t len);
+int Reseed_Check(st_state *state, size_t len);
+int Reseed_Prediction(st_state *state, u8 *re_add_data);
+int Reseed_Prefetch_Start(void);
+void Reseed_Prefetch_Stop(void);
+
+
+/*
+*   Fork detection
+*   A child process gets a new generation. States (re)seeded in an older
+*   one reseed from fresh entropy before their next output, and buffered
+*   output or entropy is dropped; page-backed buffers are MADV_WIPEONFORK.
+*/
+unsigned long Fork_Generation(void);
+int Fork_Reseed(st_state *state);
+int Fork_Wipe(void *ptr, size_t len);
+
+
+/*
+*   Entropy sources
+*   Entropy_Read(NULL, ...) reads the default source, getrandom unless
+*   Entropy_Set chose another. The getrandom source buffers ENTROPY_BATCH
+*   bytes per syscall; the mock source is deterministic and never random.
+*
+*   Every byte a source produces goes through the SP 800-90B repetition
+*   count and adaptive proportion tests. A failure is reported to the
+*   health callback and latches: the source refuses reads until Health_Init
+*   resets it.
+*/
+#define ENTROPY_BATCH 4096
+#define HEALTH_ALPHA  40  // false positive rate 2^-40 per test
+#define HEALTH_WINDOW 512 // APT window, non-binary samples
+#define HEALTH_RCT 1
+#define HEALTH_APT 2
+
+typedef struct _HEALTH {
+    double h; // claimed min-entropy per byte
+    unsigned int rct_cutoff, apt_cutoff;
+    unsigned int rct_run, apt_count, apt_pos;
+    u8 rct_value, apt_value;
+    int failed;
+    unsigned long long samples;
+} st_health;
+
+typedef struct _ENTROPY {
+    const char *name;
+    int (*read)(struct _ENTROPY *src, u8 *out, size_t len);
+    void (*release)(struct _ENTROPY *src);
+    st_health health;
+} st_entropy;
+
+void Health_Init(st_health *health, double h);
+int Health_Test(st_health *health, const char *name, const u8 *x, size_t len);
+void Health_Callback(void (*callback)(const char *name, int test, void *arg), void *arg);
+
+st_entropy *Entropy_Getrandom(void);
+st_entropy *Entropy_Mock_New(unsigned long long seed);
+void Entropy_Free(st_entropy *src);
+void Entropy_Set(st_entropy *src);
+st_entropy *Entropy_Default(void);
+int Entropy_Read(st_entropy *src, u8 *out, size_t len);
+
+
+/*
+*   Streaming conditioner
+*   Block_Cipher_df as an SP 800-90B vetted conditioning component over a
+*   continuous raw stream: every CONDITION_OUT output bytes are the df of
+*   ratio * CONDITION_OUT raw bytes. Chunks are conditioned CONDITION_CHUNKS
+*   at a time, their BCC chains interleaved in cbc_mac_chains.
+*/
+#define CONDITION_OUT (LEN_SEED * BLOCK_SIZE)
+#define CONDITION_CHUNKS 16
+#define CONDITION_MAX_RATIO 64
+
+typedef struct _CONDITIONER st_conditioner;
+
+st_conditioner *Condition_New(unsigned int ratio);
+size_t Condition_Output_Len(const st_conditioner *cond, size_t len);
+size_t Condition_Feed(st_conditioner *cond, const u8 *raw, size_t len, u8 *out);
+void Condition_Free(st_conditioner *cond);
+
+
+/*
+*   CPU jitter entropy source
+*   Timing of a memory access loop, health tested at a claimed JITTER_H
+*   bits per sample and conditioned at JITTER_RATIO samples per output
+*   byte. getrandom falls back to it while the kernel pool is not yet
+*   initialized instead of blocking.
+*/
+#define JITTER_MEM (64 * 1024) // power of two, larger than L1
+#define JITTER_ACCESSES 16
+#define JITTER_RATIO 24 // 384 bits claimed per 256 output, SP 800-90B asks n + 64
+#define JITTER_H 0.5
+
+st_entropy *Entropy_Jitter_New(void);
+
+
+/*
+*   Split
+*   Derives an independent child instance from a parent without the
+*   derivation function: one parent generate of SEED_LEN bytes becomes the
+*   child's seed material. For recursive task-parallel jobs, each task
+*   splits its own generator instead of drawing from a shared one.
+*/
+int DRBG_Split(st_state *parent, st_state *child);
+
+
+/*
+*   Parallel fill
+*   One state fills one large buffer on several threads. The requests'
+*   keys and counters are planned in order on the calling thread, the
+*   counter blocks are then shared out in grains; output and final state
+*   equal those of generate_Bytes.
+*/
+#define PARALLEL_THREADS 64
+#define PARALLEL_WINDOW 256            // requests planned at a time
+#define PARALLEL_GRAIN (16 * 1024)     // bytes, divides MAX_REQUEST_LEN
+
+int generate_parallel(st_state *state, u8 *out, size_t len, int nthreads);
+
+
+/*
+*   File fill
+*   Fills a file or block device with DRBG output, one thread and one split
+*   instance per segment, writing through O_DIRECT or an mmap of the
+*   segment, with progress reported to a callback.
+*/
+#define FILL_DIRECT 0x1
+#define FILL_MMAP   0x2
+#define FILL_ALIGN 4096              // O_DIRECT and segment alignment
+#define FILL_BUFFER (4 << 20)        // bytes per write, multiple of FILL_ALIGN
+#define FILL_SEGMENTS_MAX 256
+#define FILL_PROGRESS_MS 500
+
+int DRBG_File_Fill(const char *path, unsigned long long size, int segments, unsigned int flags,
+                   void (*progress)(unsigned long long done, unsigned long long total, double seconds, void *arg), void *arg);
+
+
+/*
+*   Randomness daemon
+*   Serves DRBG output over a Unix socket: the client sends a 4-byte
+*   big-endian length, the daemon answers with that many bytes. One worker
+*   per core with its own instance and epoll loop; small requests of one
+*   loop round are coalesced into a single generate. Reseeds follow the
+*   reseed policy with the prefetch thread running.
+*/
+#define DAEMON_SOCKET "/run/ctrdrbg.sock"
+#define DAEMON_MAX_REQUEST (1 << 20)
+#define DAEMON_SMALL 4096            // coalesced at or below this
+#define DAEMON_BATCH (64 * 1024)     // coalesced bytes per generate
+#define DAEMON_EVENTS 256
+#define DAEMON_TICK_MS 200
+
+typedef struct _DAEMON st_daemon;
+
+st_daemon *DRBG_Daemon_New(const char *path, int workers);
+int DRBG_Daemon_Run(st_daemon *daemon);
+void DRBG_Daemon_Stop(st_daemon *daemon);
+void DRBG_Daemon_Free(st_daemon *daemon);
+
+int DRBG_Client_Open(const char *path);
+int DRBG_Client_Read(int fd, u8 *out, size_t len);
+void DRBG_Client_Close(int fd);
+
+
+/*
+*   Shared-memory ring
+*   A producer thread keeps one sealed memfd per consumer filled with
+*   DRBG output; the consumer maps only its own and claims slots with a
+*   CAS, erasing them as it reads, without a system call while the ring
+*   has bytes.
+*/
+#define RING_SLOT 4096               // bytes per claim
+#define RING_SLOTS 256               // slots per consumer, 1 MiB
+#define RING_CONSUMERS 64
+#define RING_NAP_US 100              // producer sleep when every ring is full
+
+typedef struct _RING st_ring;
+typedef struct _RING_READER st_ring_reader;
+
+st_ring *DRBG_Ring_New(int consumers);
+int DRBG_Ring_Fd(st_ring *ring, int consumer);
+void DRBG_Ring_Free(st_ring *ring);
+st_ring_reader *DRBG_Ring_Attach(int fd);
+int DRBG_Ring_Read(st_ring_reader *reader, u8 *out, size_t len);
+void DRBG_Ring_Detach(st_ring_reader *reader);
+
+/*
+*   Secure memory
+*   mlocked, guard-paged regions for DRBG states, key schedules and output
+*   buffers, zeroized on release. Small allocations share a region, large
+*   ones get their own, on huge pages with SECURE_HUGE. Secure_Alloc_Node
+*   places the pages on a NUMA node, node -1 leaves them to first touch.
+*   Not for memory shared with other processes.
+*/
+#define SECURE_WIPE 0x1              // MADV_WIPEONFORK, a forked child reads zeros
+#define SECURE_HUGE 0x2              // 2 MiB pages, large allocations only
+#define SECURE_CHUNK CACHE_LINE
+#define SECURE_REGION (256 * 1024)   // shared by allocations below SECURE_LARGE
+#define SECURE_LARGE (64 * 1024)
+#define SECURE_HUGE_PAGE (2 << 20)
+
+void *Secure_Alloc(size_t len, unsigned int flags);
+void *Secure_Alloc_Node(size_t len, unsigned int flags, int node);
+void Secure_Free(void *ptr);
+void Secure_Stats(size_t *locked, size_t *unlocked);
+
+/*
+*   NUMA placement
+*   Node of the calling CPU, page placement and thread pinning from the
+*   sysfs topology and raw system calls, without libnuma. Thread instances
+*   and pools stay on the node their thread first asked on, seeded from
+*   that node's master, and each node's pools are refilled by a thread
+*   pinned to the node.
+*/
+#define NUMA_NODES 64
+#define NUMA_CPUS 4096
+
+int Numa_Nodes(void);
+int Numa_Node(void);
+int Numa_Bind(void *ptr, size_t len, int node);
+int Numa_Pin(int node);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,57 @@
+#ifndef TESTS_CHECK_H
+#define TESTS_CHECK_H
+
+#include "../header.h"
+
+/*
+*   Test helpers
+*   Every test is a program of its own: one line per check, exit status 1
+*   if any check failed. make test builds and runs them all.
+*/
+static int CHECK_FAILED = 0;
+
+#define CHECK(cond, name)                                       \
+    do                                                          \
+    {                                                           \
+        int check_ok = (cond);                                  \
+        printf("%-4s %s\n", check_ok ? "ok" : "FAIL", name);    \
+        if (!check_ok)                                          \
+            CHECK_FAILED++;                                     \
+    } while (0)
+
+#define CHECK_DONE() (CHECK_FAILED != 0)
+
+/*
+*   Reference CTR_DRBG pieces on the reference ARIA (aria.c), independent
+*   of the kernels and of every optimized path under test.
+*/
+static inline void ref_encrypt(const u8 *key, const u8 *in, u8 *out)
+{
+    u8 round_key[ROUND_KEY_LEN];
+
+    Crypt(in, EncKeySetup(key, round_key, KEY_BIT), round_key, out);
+}
+
+static inline void ref_increment(u8 *V)
+{
+    for (int cnt_i = BLOCK_SIZE - 1; cnt_i >= 0 && ++V[cnt_i] == 0; cnt_i--)
+        ;
+}
+
+//! SP 800-90A 10.2.1.2
+static inline void ref_update(const u8 *provided, u8 *key, u8 *V)
+{
+    u8 temp[SEED_LEN];
+
+    for (int cnt_i = 0; cnt_i < LEN_SEED; cnt_i++)
+    {
+        ref_increment(V);
+        ref_encrypt(key, V, temp + cnt_i * BLOCK_SIZE);
+    }
+    for (int cnt_i = 0; cnt_i < SEED_LEN; cnt_i++)
+        temp[cnt_i] ^= provided[cnt_i];
+    memcpy(key, temp, KEY_SIZE);
+    memcpy(V, temp + KEY_SIZE, BLOCK_SIZE);
+}
+
+#endif
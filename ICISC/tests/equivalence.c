@@ -0,0 +1,148 @@
+#include "check.h"
+
+/*
+*   Equivalence: every batched, compact or parallel path gives the bytes
+*   and the final state of the serial Instantiate / generate_Bytes, over
+*   lengths that cover partial blocks and requests split at MAX_REQUEST_LEN.
+*/
+#define EQ_STATES 37 // more than one BATCH_STATES group, not a multiple of it
+#define EQ_BIG (2 * MAX_REQUEST_LEN + 100)
+
+static const size_t EQ_LENS[] = {0, 1, 15, 16, 17, 100, MAX_REQUEST_LEN, MAX_REQUEST_LEN + 1, EQ_BIG};
+#define EQ_COUNT (sizeof(EQ_LENS) / sizeof(EQ_LENS[0]))
+
+static u8 IN[EQ_STATES][INSTANCE_INPUT];
+static u8 OUT[EQ_STATES][EQ_BIG];
+static u8 REF[EQ_BIG];
+
+static void eq_input(void)
+{
+    for (int cnt_i = 0; cnt_i < EQ_STATES; cnt_i++)
+    {
+        for (int cnt_j = 0; cnt_j < INSTANCE_INPUT; cnt_j++)
+            IN[cnt_i][cnt_j] = (u8)(cnt_i * 31 + cnt_j * 7 + 1);
+    }
+}
+
+static int eq_state(const st_state *a, const st_state *b)
+{
+    return memcmp(a->key, b->key, KEY_SIZE) == 0 && memcmp(a->V, b->V, BLOCK_SIZE) == 0 &&
+           a->Reseed_counter == b->Reseed_counter && a->Reseed_bytes == b->Reseed_bytes;
+}
+
+static void test_instantiate_batch(void)
+{
+    static st_state batch[EQ_STATES], serial[EQ_STATES];
+    st_state *ptr[EQ_STATES];
+    u8 *in[EQ_STATES];
+    int ok = TRUE;
+
+    for (int cnt_i = 0; cnt_i < EQ_STATES; cnt_i++)
+    {
+        ptr[cnt_i] = &batch[cnt_i];
+        in[cnt_i] = IN[cnt_i];
+        Instantiate(&serial[cnt_i], IN[cnt_i]);
+    }
+    Instantiate_Batch(ptr, EQ_STATES, in);
+    for (int cnt_i = 0; cnt_i < EQ_STATES; cnt_i++)
+        ok &= eq_state(&batch[cnt_i], &serial[cnt_i]) && batch[cnt_i].fork_gen == serial[cnt_i].fork_gen;
+    CHECK(ok, "Instantiate_Batch = Instantiate");
+}
+
+static void test_generate_batch(void)
+{
+    static st_state batch[EQ_STATES], serial[EQ_STATES];
+    st_state *ptr[EQ_STATES];
+    u8 *out[EQ_STATES];
+    int ok = TRUE;
+
+    for (int cnt_i = 0; cnt_i < EQ_STATES; cnt_i++)
+    {
+        Instantiate(&batch[cnt_i], IN[cnt_i]);
+        serial[cnt_i] = batch[cnt_i];
+        ptr[cnt_i] = &batch[cnt_i];
+        out[cnt_i] = OUT[cnt_i];
+    }
+    for (size_t cnt_l = 0; cnt_l < EQ_COUNT; cnt_l++)
+    {
+        size_t len = EQ_LENS[cnt_l];
+
+        ok &= generate_Batch(ptr, EQ_STATES, out, len, NULL);
+        for (int cnt_i = 0; cnt_i < EQ_STATES; cnt_i++)
+        {
+            ok &= generate_Bytes(&serial[cnt_i], REF, len, NULL);
+            ok &= memcmp(OUT[cnt_i], REF, len) == 0 && eq_state(&batch[cnt_i], &serial[cnt_i]);
+        }
+    }
+    CHECK(ok, "generate_Batch = generate_Bytes");
+}
+
+static void test_arena(void)
+{
+    static st_state serial[EQ_STATES];
+    st_arena *arena = Arena_New(EQ_STATES, 4); // fewer cache entries than instances
+    long id[EQ_STATES];
+    int ok = arena != NULL;
+
+    for (int cnt_i = 0; ok && cnt_i < EQ_STATES; cnt_i++)
+    {
+        id[cnt_i] = Arena_Instantiate(arena, IN[cnt_i], 0);
+        Instantiate(&serial[cnt_i], IN[cnt_i]);
+        ok &= id[cnt_i] >= 0;
+    }
+    for (size_t cnt_l = 0; ok && cnt_l < EQ_COUNT; cnt_l++)
+    {
+        for (int cnt_i = 0; cnt_i < EQ_STATES; cnt_i++)
+        {
+            size_t len = EQ_LENS[(cnt_l + (size_t)cnt_i) % EQ_COUNT];
+
+            ok &= Arena_Generate(arena, id[cnt_i], OUT[0], len, NULL);
+            ok &= generate_Bytes(&serial[cnt_i], REF, len, NULL);
+            ok &= memcmp(OUT[0], REF, len) == 0;
+        }
+    }
+    //! a removed record is reused from the free list
+    if (ok)
+    {
+        Arena_Remove(arena, id[5]);
+        id[5] = Arena_Instantiate(arena, IN[0], 0);
+        Instantiate(&serial[5], IN[0]);
+        ok &= Arena_Generate(arena, id[5], OUT[0], 100, NULL) && generate_Bytes(&serial[5], REF, 100, NULL);
+        ok &= memcmp(OUT[0], REF, 100) == 0;
+    }
+    Arena_Free(arena);
+    CHECK(ok, "Arena_Generate = generate_Bytes");
+}
+
+static void test_parallel(void)
+{
+    static const int threads[] = {1, 2, 3, 8};
+    static u8 big[5 * MAX_REQUEST_LEN + 33], ref[5 * MAX_REQUEST_LEN + 33];
+    int ok = TRUE;
+
+    for (size_t cnt_t = 0; cnt_t < sizeof(threads) / sizeof(threads[0]); cnt_t++)
+    {
+        for (size_t cnt_l = 0; cnt_l < EQ_COUNT + 1; cnt_l++)
+        {
+            size_t len = cnt_l < EQ_COUNT ? EQ_LENS[cnt_l] : sizeof(big);
+            st_state parallel, serial;
+
+            Instantiate(&parallel, IN[cnt_l]);
+            serial = parallel;
+            ok &= generate_parallel(&parallel, big, len, threads[cnt_t]);
+            ok &= generate_Bytes(&serial, ref, len, NULL);
+            ok &= memcmp(big, ref, len) == 0 && eq_state(&parallel, &serial);
+        }
+    }
+    CHECK(ok, "generate_parallel = generate_Bytes");
+}
+
+int main(void)
+{
+    eq_input();
+    test_instantiate_batch();
+    test_generate_batch();
+    test_arena();
+    test_parallel();
+    return CHECK_DONE();
+}
@@ -0,0 +1,120 @@
+#include "check.h"
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+/*
+*   Fork divergence: after fork() and after a raw fork system call that
+*   bypasses pthread_atfork, the child's next output differs from the
+*   parent's for every kind of instance and for the entropy batch.
+*/
+#define FORK_BYTES 64
+
+typedef int (*fork_gen_fn)(u8 *out, size_t len);
+
+static st_state STATE;
+static st_shared_drbg *SHARED;
+static st_arena *ARENA;
+static long ARENA_ID;
+
+static int gen_state(u8 *out, size_t len)
+{
+    return generate_Bytes(&STATE, out, len, NULL);
+}
+
+static int gen_thread(u8 *out, size_t len)
+{
+    return DRBG_Thread_Generate(out, len);
+}
+
+static int gen_pool(u8 *out, size_t len)
+{
+    return DRBG_Pool_Get(out, len);
+}
+
+static int gen_shared(u8 *out, size_t len)
+{
+    return DRBG_Shared_Generate(SHARED, out, len);
+}
+
+static int gen_arena(u8 *out, size_t len)
+{
+    return Arena_Generate(ARENA, ARENA_ID, out, len, NULL);
+}
+
+static int gen_entropy(u8 *out, size_t len)
+{
+    return Entropy_Read(NULL, out, len);
+}
+
+//! TRUE if parent and child both generated and got different bytes
+static int fork_diverges(fork_gen_fn gen, int raw)
+{
+    u8 parent[FORK_BYTES], child[FORK_BYTES];
+    int fd[2], ok = FALSE, child_ok = FALSE;
+    pid_t pid;
+
+    //! state in use before the fork, buffers filled
+    if (!gen(parent, 16) || pipe(fd) != 0)
+        return FALSE;
+#if defined(SYS_fork)
+    pid = raw ? (pid_t)syscall(SYS_fork) : fork();
+#else
+    (void)raw;
+    pid = fork();
+#endif
+    if (pid == 0)
+    {
+        child_ok = gen(child, FORK_BYTES);
+        if (write(fd[1], &child_ok, sizeof(child_ok)) != sizeof(child_ok) ||
+            write(fd[1], child, FORK_BYTES) != FORK_BYTES)
+            _exit(1);
+        _exit(0);
+    }
+    if (pid > 0)
+    {
+        ok = gen(parent, FORK_BYTES);
+        ok &= read(fd[0], &child_ok, sizeof(child_ok)) == sizeof(child_ok) &&
+              read(fd[0], child, FORK_BYTES) == FORK_BYTES;
+        waitpid(pid, NULL, 0);
+    }
+    close(fd[0]);
+    close(fd[1]);
+    return ok && child_ok && memcmp(parent, child, FORK_BYTES) != 0;
+}
+
+int main(void)
+{
+    static const struct {
+        const char *name;
+        fork_gen_fn gen;
+    } kinds[] = {
+        {"state", gen_state}, {"thread", gen_thread}, {"pool", gen_pool},
+        {"shared", gen_shared}, {"arena", gen_arena}, {"entropy", gen_entropy}};
+    u8 in[INSTANCE_INPUT];
+    char name[64];
+
+    memset(in, 0x5c, INSTANCE_INPUT);
+    Instantiate(&STATE, in);
+    DRBG_Thread_Init(in);
+    SHARED = DRBG_Shared_New(in);
+    ARENA = Arena_New(4, 0);
+    ARENA_ID = ARENA != NULL ? Arena_Instantiate(ARENA, in, 0) : -1;
+    Reseed_Prefetch_Start();
+    DRBG_Pool_Start();
+
+    for (int raw = 0; raw < 2; raw++)
+    {
+        for (size_t cnt_i = 0; cnt_i < sizeof(kinds) / sizeof(kinds[0]); cnt_i++)
+        {
+            snprintf(name, sizeof(name), "%s diverges after %s", kinds[cnt_i].name, raw ? "a raw fork" : "fork()");
+            CHECK(fork_diverges(kinds[cnt_i].gen, raw), name);
+        }
+    }
+
+    DRBG_Pool_Stop();
+    Reseed_Prefetch_Stop();
+    Arena_Free(ARENA);
+    DRBG_Shared_Free(SHARED);
+    return CHECK_DONE();
+}
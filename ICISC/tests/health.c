@@ -0,0 +1,217 @@
+#include "check.h"
+#include <math.h>
+
+/*
+*   SP 800-90B health tests: the RCT and APT cutoffs against the formulas,
+*   a stuck and a biased source failing Entropy_Read with the callback
+*   fired and the failure latched, a good source passing. The vector path
+*   (one Health_Test over a buffer) against the byte loop (the same bytes
+*   one call each) on random data with runs planted at and below the RCT
+*   cutoff, at every offset around a 32-byte step.
+*/
+#define HEALTH_BYTES (64 * 1024)
+#define HEALTH_SOURCE_STUCK  0
+#define HEALTH_SOURCE_BIASED 1
+
+typedef struct _TEST_SOURCE {
+    st_entropy base;
+    int kind;
+    unsigned long long n; // bytes produced
+} st_test_source;
+
+static int CALLS, LAST_TEST;
+static const char *LAST_NAME;
+
+static void on_failure(const char *name, int test, void *arg)
+{
+    (void)arg;
+    CALLS++;
+    LAST_TEST = test;
+    LAST_NAME = name;
+}
+
+static unsigned long long splitmix(unsigned long long *x)
+{
+    unsigned long long z = (*x += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+//! stuck: one value; biased: every other byte is 0x41, no two in a row equal
+static int source_read(st_entropy *src, u8 *out, size_t len)
+{
+    st_test_source *s = (st_test_source *)src;
+
+    for (size_t cnt_i = 0; cnt_i < len; cnt_i++, s->n++)
+    {
+        if (s->kind == HEALTH_SOURCE_STUCK)
+            out[cnt_i] = 0x5a;
+        else
+            out[cnt_i] = (s->n & 1) == 0 ? 0x41 : (u8)(0x80 | (s->n >> 1));
+    }
+    return Health_Test(&src->health, src->name, out, len);
+}
+
+static void source_init(st_test_source *s, const char *name, int kind)
+{
+    memset(s, 0, sizeof(st_test_source));
+    s->base.name = name;
+    s->base.read = source_read;
+    s->kind = kind;
+    Health_Init(&s->base.health, 8.0);
+}
+
+//! smallest k with P(X > k) <= 2^-HEALTH_ALPHA, X ~ B(n, p), from log terms
+static unsigned int ref_critbinom(unsigned int n, double p)
+{
+    double tail = 0.0;
+    unsigned int k;
+
+    for (k = n; k > 0; k--)
+    {
+        double term = exp(lgamma(n + 1.0) - lgamma(k + 1.0) - lgamma(n - k + 1.0) + k * log(p) + (n - k) * log1p(-p));
+
+        if (tail + term > ldexp(1.0, -HEALTH_ALPHA))
+            break;
+        tail += term;
+    }
+    return k;
+}
+
+static void test_cutoffs(void)
+{
+    static const double hs[] = {0.5, 1.0, 2.0, 3.5, 8.0};
+    st_health health;
+    int ok = TRUE;
+
+    for (size_t cnt_i = 0; cnt_i < sizeof(hs) / sizeof(hs[0]); cnt_i++)
+    {
+        Health_Init(&health, hs[cnt_i]);
+        ok &= health.rct_cutoff == 1 + (unsigned int)ceil(HEALTH_ALPHA / hs[cnt_i]);
+        ok &= health.apt_cutoff == 1 + ref_critbinom(HEALTH_WINDOW, pow(2.0, -hs[cnt_i]));
+    }
+    Health_Init(&health, 8.0);
+    ok &= health.rct_cutoff == 6;
+    CHECK(ok, "RCT and APT cutoffs");
+}
+
+static void test_sources(void)
+{
+    static u8 out[HEALTH_BYTES];
+    st_test_source stuck, biased;
+    st_entropy *good = Entropy_Mock_New(42);
+    int ok;
+
+    Health_Callback(on_failure, NULL);
+
+    source_init(&stuck, "stuck", HEALTH_SOURCE_STUCK);
+    CALLS = 0;
+    ok = !Entropy_Read(&stuck.base, out, 64) && CALLS == 1 && LAST_TEST == HEALTH_RCT && strcmp(LAST_NAME, "stuck") == 0;
+    ok &= !Entropy_Read(&stuck.base, out, 64) && CALLS == 1;
+    CHECK(ok, "stuck source fails the RCT, callback fired, failure latched");
+
+    source_init(&biased, "biased", HEALTH_SOURCE_BIASED);
+    CALLS = 0;
+    ok = !Entropy_Read(&biased.base, out, HEALTH_WINDOW) && CALLS == 1 && LAST_TEST == HEALTH_APT;
+    CHECK(ok, "biased source fails the APT, callback fired");
+
+    Health_Init(&stuck.base.health, 8.0);
+    stuck.kind = HEALTH_SOURCE_BIASED;
+    CHECK(Entropy_Read(&stuck.base, out, 8) && !stuck.base.health.failed, "Health_Init clears a latched failure");
+
+    CALLS = 0;
+    ok = good != NULL;
+    for (int cnt_i = 0; ok && cnt_i < 64; cnt_i++)
+        ok &= Entropy_Read(good, out, (cnt_i & 1) ? HEALTH_BYTES : 1 + (size_t)cnt_i * 7);
+    CHECK(ok && CALLS == 0, "good source passes");
+
+    Entropy_Free(good);
+    Health_Callback(NULL, NULL);
+}
+
+//! -1 if one call over x and one call per byte end differently, else whether x passed
+static int health_same(double h, const u8 *x, size_t len)
+{
+    st_health vec, ref;
+    int vec_ok, ref_ok = TRUE;
+
+    Health_Init(&vec, h);
+    Health_Init(&ref, h);
+    vec_ok = Health_Test(&vec, "vector", x, len);
+    for (size_t cnt_i = 0; ref_ok && cnt_i < len; cnt_i++)
+        ref_ok = Health_Test(&ref, "byte", x + cnt_i, 1);
+    if (vec_ok != ref_ok)
+        return -1;
+    if (!vec_ok)
+        return FALSE;
+    if (vec.rct_run != ref.rct_run || vec.rct_value != ref.rct_value || vec.apt_count != ref.apt_count ||
+        vec.apt_pos != ref.apt_pos || vec.apt_value != ref.apt_value || vec.samples != ref.samples)
+        return -1;
+    return TRUE;
+}
+
+//! x over an alphabet of 2^h values, a run of run_len planted at pos when run_len != 0
+static void health_fill(u8 *x, size_t len, unsigned int bits, unsigned long long seed, size_t pos, size_t run_len)
+{
+    unsigned long long r = seed;
+
+    for (size_t cnt_i = 0; cnt_i < len; cnt_i++)
+        x[cnt_i] = (u8)(splitmix(&r) & ((1u << bits) - 1));
+    if (run_len == 0)
+        return;
+    for (size_t cnt_i = 0; cnt_i < run_len && pos + cnt_i < len; cnt_i++)
+        x[pos + cnt_i] = x[pos];
+    //! the run ends at run_len, not by chance further on
+    if (pos + run_len < len && x[pos + run_len] == x[pos])
+        x[pos + run_len] ^= 1;
+    if (pos > 0 && x[pos - 1] == x[pos])
+        x[pos - 1] ^= 1;
+}
+
+static void test_vector(void)
+{
+    //! h = 1 gives an RCT cutoff above 32, h = 2 and 8 below
+    static const unsigned int bits[] = {1, 2, 8};
+    static u8 x[4 * HEALTH_WINDOW + 77];
+    int ok = TRUE;
+
+    for (size_t cnt_b = 0; cnt_b < sizeof(bits) / sizeof(bits[0]); cnt_b++)
+    {
+        double h = (double)bits[cnt_b];
+        st_health probe;
+
+        Health_Init(&probe, h);
+        for (size_t pos = 200; pos < 200 + 70; pos++)
+        {
+            for (unsigned int delta = 0; delta < 2; delta++)
+            {
+                size_t run = probe.rct_cutoff - 1 + delta;
+
+                //! one short of the cutoff passes, at the cutoff fails
+                health_fill(x, sizeof(x), bits[cnt_b], pos * 131 + delta, pos, run);
+                ok &= health_same(h, x, sizeof(x)) == (delta == 0);
+            }
+        }
+        for (unsigned long long seed = 1; seed <= 64; seed++)
+        {
+            health_fill(x, sizeof(x), bits[cnt_b], seed, 0, 0);
+            ok &= health_same(h, x, sizeof(x)) == TRUE;
+        }
+    }
+    //! a window dominated by one value, for the vector APT count
+    memset(x, 0x33, sizeof(x));
+    for (size_t cnt_i = 1; cnt_i < sizeof(x); cnt_i += 2)
+        x[cnt_i] = (u8)cnt_i;
+    ok &= health_same(8.0, x, sizeof(x)) == FALSE;
+    CHECK(ok, "vector health test = byte loop");
+}
+
+int main(void)
+{
+    test_cutoffs();
+    test_sources();
+    test_vector();
+    return CHECK_DONE();
+}
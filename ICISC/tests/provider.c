@@ -0,0 +1,73 @@
+#include "check.h"
+#include <openssl/core_names.h>
+#include <openssl/evp.h>
+#include <openssl/provider.h>
+#include <openssl/rand.h>
+
+/*
+*   ctrdrbg-provider against the installed libcrypto: the module loads
+*   from the build directory (make test runs from ICISC), EVP_RAND_fetch
+*   gives an instance that instantiates, generates and reseeds with
+*   additional input, a request above KEY_BIT strength is refused, and
+*   RAND_bytes runs on it once it is made the DRBG type.
+*/
+#define PROV_BYTES 64
+#define PROV_NAME "CTR-DRBG-ARIA"
+#define PROV_PROPERTIES "provider=ctrdrbg"
+
+int main(void)
+{
+    OSSL_PROVIDER *prov, *def;
+    EVP_RAND *rand = NULL;
+    EVP_RAND_CTX *ctx = NULL;
+    EVP_RAND_CTX *pub;
+    u8 a[PROV_BYTES], b[PROV_BYTES], pers[100], adin[48];
+    int ok;
+
+    memset(pers, 0x5c, sizeof(pers));
+    memset(adin, 0xa3, sizeof(adin));
+    memset(a, 0, PROV_BYTES);
+    memset(b, 0, PROV_BYTES);
+
+    OSSL_PROVIDER_set_default_search_path(NULL, ".");
+    prov = OSSL_PROVIDER_load(NULL, "ctrdrbg-provider");
+    def = OSSL_PROVIDER_load(NULL, "default");
+    CHECK(prov != NULL && def != NULL, "OSSL_PROVIDER_load ctrdrbg-provider");
+    if (prov == NULL || def == NULL)
+        return CHECK_DONE();
+
+    rand = EVP_RAND_fetch(NULL, PROV_NAME, PROV_PROPERTIES);
+    ctx = rand != NULL ? EVP_RAND_CTX_new(rand, NULL) : NULL;
+    CHECK(ctx != NULL, "EVP_RAND_fetch " PROV_NAME);
+    if (ctx == NULL)
+        return CHECK_DONE();
+
+    ok = EVP_RAND_instantiate(ctx, KEY_BIT, 0, pers, sizeof(pers), NULL);
+    CHECK(ok && EVP_RAND_get_state(ctx) == EVP_RAND_STATE_READY && EVP_RAND_get_strength(ctx) == KEY_BIT,
+          "instantiate with personalization, ready at KEY_BIT strength");
+
+    ok = EVP_RAND_generate(ctx, a, PROV_BYTES, KEY_BIT, 0, adin, sizeof(adin)) &&
+         EVP_RAND_generate(ctx, b, PROV_BYTES, KEY_BIT, 0, NULL, 0);
+    CHECK(ok && memcmp(a, b, PROV_BYTES) != 0, "generate with and without additional input");
+
+    ok = EVP_RAND_reseed(ctx, 0, NULL, 0, adin, sizeof(adin)) &&
+         EVP_RAND_generate(ctx, a, PROV_BYTES, KEY_BIT, 1, adin, 5);
+    CHECK(ok && memcmp(a, b, PROV_BYTES) != 0, "reseed with additional input, prediction resistant generate");
+
+    CHECK(!EVP_RAND_generate(ctx, a, PROV_BYTES, KEY_BIT + 1, 0, NULL, 0), "generate above KEY_BIT refused");
+    EVP_RAND_uninstantiate(ctx);
+    CHECK(!EVP_RAND_instantiate(ctx, KEY_BIT + 1, 0, NULL, 0, NULL), "instantiate above KEY_BIT refused");
+
+    EVP_RAND_CTX_free(ctx);
+    EVP_RAND_free(rand);
+
+    ok = RAND_set_DRBG_type(NULL, PROV_NAME, PROV_PROPERTIES, NULL, NULL) && RAND_bytes(a, PROV_BYTES) == 1 &&
+         RAND_priv_bytes(b, PROV_BYTES) == 1 && memcmp(a, b, PROV_BYTES) != 0;
+    pub = RAND_get0_public(NULL);
+    CHECK(ok && pub != NULL && strcmp(EVP_RAND_get0_name(EVP_RAND_CTX_get0_rand(pub)), PROV_NAME) == 0,
+          "RAND_bytes on " PROV_NAME);
+
+    OSSL_PROVIDER_unload(prov);
+    OSSL_PROVIDER_unload(def);
+    return CHECK_DONE();
+}
@@ -0,0 +1,50 @@
+#include "check.h"
+
+/*
+*   DRBG_Split against SP 800-90A 10.2.1.3.1, instantiate without the
+*   derivation function: the seed material is SEED_LEN bytes of parent
+*   output and (Key, V) = Update(seed_material, 0, 0).
+*/
+int main(void)
+{
+    u8 in[INSTANCE_INPUT];
+    int key_ok = TRUE, parent_ok = TRUE, flags_ok = TRUE, distinct = TRUE;
+
+    for (int cnt_i = 0; cnt_i < INSTANCE_INPUT; cnt_i++)
+        in[cnt_i] = (u8)(0xA5 ^ cnt_i);
+
+    for (int cnt_r = 0; cnt_r < 64; cnt_r++)
+    {
+        st_state parent, copy, child;
+        u8 seed[SEED_LEN], key[KEY_SIZE] = {0x00}, V[BLOCK_SIZE] = {0x00};
+
+        in[0] = (u8)cnt_r;
+        Instantiate(&parent, in);
+        copy = parent;
+        generate_Bytes(&copy, seed, SEED_LEN, NULL);
+        ref_update(seed, key, V);
+
+        if (!DRBG_Split(&parent, &child))
+        {
+            key_ok = FALSE;
+            continue;
+        }
+        key_ok &= memcmp(child.key, key, KEY_SIZE) == 0 && memcmp(child.V, V, BLOCK_SIZE) == 0;
+        parent_ok &= memcmp(parent.key, copy.key, KEY_SIZE) == 0 && memcmp(parent.V, copy.V, BLOCK_SIZE) == 0;
+        flags_ok &= child.fork_gen == parent.fork_gen && child.Reseed_counter == 0 && child.Reseed_bytes == 0;
+        distinct &= memcmp(child.key, parent.key, KEY_SIZE) != 0;
+    }
+    {
+        //! the parent's generate reseeds from the entropy source here
+        st_state parent, child;
+
+        Instantiate(&parent, in);
+        parent.prediction_flag = TRUE;
+        flags_ok &= DRBG_Split(&parent, &child) && child.prediction_flag == TRUE;
+    }
+    CHECK(key_ok, "DRBG_Split = no-df instantiate from SEED_LEN parent bytes");
+    CHECK(parent_ok, "DRBG_Split advances the parent by one SEED_LEN generate");
+    CHECK(flags_ok, "DRBG_Split child counters, fork generation, prediction flag");
+    CHECK(distinct, "DRBG_Split child differs from parent");
+    return CHECK_DONE();
+}
@@ -0,0 +1,40 @@
+#include "../header.h"
+#include <signal.h>
+
+/*
+*   ctrdrbg-daemon : serve DRBG output on a Unix socket
+*
+*   ctrdrbg-daemon [SOCKET [WORKERS]]
+*
+*   SOCKET defaults to DAEMON_SOCKET, WORKERS to one per online CPU.
+*   SIGINT and SIGTERM stop it. Clients use DRBG_Client_Open/Read/Close.
+*
+*   build (in ICISC) : make ctrdrbg-daemon
+*/
+static st_daemon *DAEMON = NULL;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    if (DAEMON != NULL)
+        DRBG_Daemon_Stop(DAEMON);
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = argc > 1 ? argv[1] : DAEMON_SOCKET;
+    int workers = argc > 2 ? atoi(argv[2]) : 0;
+
+    DAEMON = DRBG_Daemon_New(path, workers);
+    if (DAEMON == NULL)
+    {
+        fprintf(stderr, "%s: cannot listen\n", path);
+        return 1;
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+    DRBG_Daemon_Run(DAEMON);
+    DRBG_Daemon_Free(DAEMON);
+    return 0;
+}
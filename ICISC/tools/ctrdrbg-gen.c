@@ -0,0 +1,312 @@
+#define _GNU_SOURCE // vmsplice, F_SETPIPE_SZ
+#include "../header.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+/*
+*   ctrdrbg-gen : DRBG output to stdout
+*
+*   ctrdrbg-gen [--cipher aria] [--key-bits 128] [--bytes N[K|M|G|T]]
+*               [--instances N] [--kernel NAME] [--buffer N[K|M]]
+*   ctrdrbg-gen --output PATH [--bytes N] [--segments N] [--direct | --mmap]
+*
+*   Output is generated into two page-aligned halves. Into a pipe the
+*   halves are vmspliced, so the pages are handed to the reader without a
+*   copy; the pipe is resized to one half, and once the second half is in
+*   the pipe the reader has consumed every page of the first, which can
+*   then be overwritten. Other outputs get plain write(). Without --bytes
+*   the stream does not end.
+*
+*   With --output the file or block device is filled by DRBG_File_Fill,
+*   --bytes defaulting to its current size, with progress on stderr.
+*
+*   The cipher and key size are fixed when the library is built
+*   (header.h), the options only check that they match.
+*
+*   build (in ICISC) : make ctrdrbg-gen
+*/
+#define GEN_BUFFER (1 << 20)
+#define GEN_INSTANCES_MAX BATCH_STATES
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [--cipher aria] [--key-bits %d] [--bytes N[K|M|G|T]]\n"
+            "       [--instances 1..%d] [--kernel NAME] [--buffer N[K|M]]\n"
+            "       %s --output PATH [--bytes N] [--segments 1..%d] [--direct | --mmap]\n",
+            name, KEY_BIT, GEN_INSTANCES_MAX, name, FILL_SEGMENTS_MAX);
+}
+
+//! N with an optional binary suffix, FALSE on junk
+static int parse_size(const char *s, unsigned long long *out)
+{
+    char *end;
+    unsigned long long v = strtoull(s, &end, 10);
+    int shift = 0;
+
+    if (end == s)
+        return FALSE;
+    switch (*end)
+    {
+    case 'T': case 't': shift = 40; break;
+    case 'G': case 'g': shift = 30; break;
+    case 'M': case 'm': shift = 20; break;
+    case 'K': case 'k': shift = 10; break;
+    case '\0': break;
+    default: return FALSE;
+    }
+    if (*end != '\0' && end[1] != '\0')
+        return FALSE;
+    if (shift != 0 && v > (~0ULL >> shift))
+        return FALSE;
+    *out = v << shift;
+    return TRUE;
+}
+
+//! one half of len bytes, the instances filling equal slices of it
+static int gen_fill(st_state **state, int instances, u8 *buf, size_t len)
+{
+    u8 *slice[GEN_INSTANCES_MAX];
+    size_t each = len / (size_t)instances;
+
+    if (instances == 1)
+        return generate_Bytes(state[0], buf, len, NULL);
+    for (int cnt_i = 0; cnt_i < instances; cnt_i++)
+    {
+        slice[cnt_i] = buf + each * (size_t)cnt_i;
+    }
+    if (!generate_Batch(state, instances, slice, each, NULL))
+        return FALSE;
+    return len % (size_t)instances == 0 || generate_Bytes(state[0], buf + each * (size_t)instances, len % (size_t)instances, NULL);
+}
+
+static void gen_progress(unsigned long long done, unsigned long long total, double seconds, void *arg)
+{
+    (void)arg;
+    fprintf(stderr, "\r%llu / %llu MiB  %.0f MiB/s ", done >> 20, total >> 20, seconds > 0 ? done / seconds / (1 << 20) : 0.0);
+}
+
+static int gen_write(int fd, const u8 *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, buf, len);
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return FALSE;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return TRUE;
+}
+
+static int gen_vmsplice(int fd, const u8 *buf, size_t len)
+{
+    while (len > 0)
+    {
+        struct iovec iov = {(void *)buf, len};
+        ssize_t n = vmsplice(fd, &iov, 1, 0);
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return FALSE;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return TRUE;
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option options[] = {
+        {"cipher", required_argument, NULL, 'c'},
+        {"key-bits", required_argument, NULL, 'k'},
+        {"bytes", required_argument, NULL, 'n'},
+        {"instances", required_argument, NULL, 'i'},
+        {"kernel", required_argument, NULL, 'K'},
+        {"buffer", required_argument, NULL, 'b'},
+        {"output", required_argument, NULL, 'o'},
+        {"segments", required_argument, NULL, 's'},
+        {"direct", no_argument, NULL, 'D'},
+        {"mmap", no_argument, NULL, 'M'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}};
+    unsigned long long total = 0, half = GEN_BUFFER, value;
+    int bounded = FALSE, instances = 1, pipe_out = FALSE, opt, ret = 0;
+    const char *output = NULL;
+    int segments = 1;
+    unsigned int fill_flags = 0;
+    st_state states[GEN_INSTANCES_MAX];
+    st_state *state[GEN_INSTANCES_MAX];
+    u8 in[INSTANCE_INPUT];
+    struct stat st;
+    u8 *buf;
+
+    while ((opt = getopt_long(argc, argv, "c:k:n:i:K:b:o:s:DMh", options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            if (strcmp(optarg, "aria") != 0)
+            {
+                fprintf(stderr, "cipher %s: this build is ARIA only\n", optarg);
+                return 2;
+            }
+            break;
+        case 'k':
+            if (atoi(optarg) != KEY_BIT)
+            {
+                fprintf(stderr, "key-bits %s: this build is %d-bit, see header.h\n", optarg, KEY_BIT);
+                return 2;
+            }
+            break;
+        case 'n':
+            if (!parse_size(optarg, &total))
+            {
+                usage(argv[0]);
+                return 2;
+            }
+            bounded = TRUE;
+            break;
+        case 'i':
+            instances = atoi(optarg);
+            if (instances < 1 || instances > GEN_INSTANCES_MAX)
+            {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 'K':
+            if (Kernel_Find(optarg) == NULL || !Kernel_Select(Kernel_Find(optarg)))
+            {
+                fprintf(stderr, "kernel %s: unknown or not supported here\n", optarg);
+                return 2;
+            }
+            break;
+        case 'b':
+            if (!parse_size(optarg, &value) || value < 4096 || value > (1ULL << 28))
+            {
+                usage(argv[0]);
+                return 2;
+            }
+            half = value;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 's':
+            segments = atoi(optarg);
+            if (segments < 1 || segments > FILL_SEGMENTS_MAX)
+            {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 'D':
+            fill_flags |= FILL_DIRECT;
+            break;
+        case 'M':
+            fill_flags |= FILL_MMAP;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+
+    if (output != NULL)
+    {
+        if (!DRBG_File_Fill(output, total, segments, fill_flags, gen_progress, NULL))
+        {
+            fprintf(stderr, "\n%s: fill failed\n", output);
+            return 1;
+        }
+        fputc('\n', stderr);
+        return 0;
+    }
+
+    //! a closed reader is an EPIPE from write or vmsplice, not a signal
+    signal(SIGPIPE, SIG_IGN);
+
+    //! a pipe holds exactly one half, see above
+    if (fstat(STDOUT_FILENO, &st) == 0 && S_ISFIFO(st.st_mode))
+    {
+        int size = fcntl(STDOUT_FILENO, F_SETPIPE_SZ, (int)half);
+
+        if (size < 0)
+            size = fcntl(STDOUT_FILENO, F_GETPIPE_SZ);
+        if (size > 0)
+        {
+            half = (unsigned long long)size;
+            pipe_out = TRUE;
+        }
+    }
+    half = (half + 4095) & ~4095ULL;
+
+    buf = (u8 *)mmap(NULL, 2 * half, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED)
+    {
+        perror("mmap");
+        return 1;
+    }
+#if defined(MADV_DONTDUMP)
+    madvise(buf, 2 * half, MADV_DONTDUMP);
+#endif
+
+    for (int cnt_i = 0; cnt_i < instances; cnt_i++)
+    {
+        if (!Entropy_Read(NULL, in, INSTANCE_INPUT))
+        {
+            fprintf(stderr, "no entropy\n");
+            return 1;
+        }
+        Instantiate(&states[cnt_i], in);
+        state[cnt_i] = &states[cnt_i];
+    }
+    clear(in, INSTANCE_INPUT);
+
+    for (unsigned long long cnt_h = 0; !bounded || total > 0; cnt_h ^= 1)
+    {
+        u8 *p = buf + cnt_h * half;
+        size_t n = (size_t)(bounded && total < half ? total : half);
+
+        if (!gen_fill(state, instances, p, n))
+        {
+            fprintf(stderr, "generate failed\n");
+            ret = 1;
+            break;
+        }
+        if (!(pipe_out ? gen_vmsplice(STDOUT_FILENO, p, n) : gen_write(STDOUT_FILENO, p, n)))
+        {
+            //! the reader went away, as for head -c
+            if (errno != EPIPE)
+            {
+                perror("write");
+                ret = 1;
+            }
+            break;
+        }
+        if (bounded)
+            total -= n;
+    }
+
+    //! vmspliced pages may still sit in the pipe, the reader sees them unchanged
+    if (!pipe_out)
+        clear(buf, (int)(2 * half));
+    munmap(buf, 2 * half);
+    clear((u8 *)states, sizeof(states));
+    return ret;
+}
@@ -0,0 +1,381 @@
+#define _GNU_SOURCE // RTLD_NEXT
+#include "../header.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdarg.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+
+/*
+*   ctrdrbg-preload : getrandom, getentropy and /dev/urandom from the DRBG
+*
+*   LD_PRELOAD=./libctrdrbg-preload.so program
+*
+*   Every thread gets its own instance, instantiated from the kernel's
+*   getrandom on first use, and serves small requests from a PRELOAD_BUFFER
+*   buffer it refills with one generate, erasing bytes as they go out.
+*   Requests of a buffer or more are generated straight into the caller's
+*   memory. Reseeds follow the library's reseed policy.
+*
+*   /dev/urandom opened through open, open64, openat or openat64, and
+*   checked once with fstat to be the urandom device (1, 9), is remembered
+*   by fd (below PRELOAD_FDS) and read, __read_chk served the same way with
+*   no system call; the real fd stays open, so fstat and poll still work.
+*   close, fclose, close_range and closefrom forget it, dup2 and dup3 carry
+*   it over. An fd closed behind the shim's back (a raw syscall, posix_spawn
+*   file actions) and reused keeps being served from the DRBG. Streams from
+*   fopen and reads through readv or pread go to the kernel as before.
+*
+*   A call made while the thread is already inside the DRBG, from a signal
+*   handler, goes to the kernel.
+*
+*   A forked child (Fork_Generation) reinstantiates each instance before
+*   its first byte, so parent and child never share a stream. If the
+*   kernel cannot seed an instance the call goes to the kernel.
+*
+*   build (in ICISC) : make libctrdrbg-preload.so
+*/
+#define PRELOAD_BUFFER 4096
+#define PRELOAD_FDS 1024
+#define PRELOAD_EXPORT __attribute__((visibility("default")))
+#define PRELOAD_URANDOM "/dev/urandom"
+
+typedef struct _PRELOAD_THREAD {
+    st_state state;
+    unsigned long fork_gen; // Fork_Generation() when the instance was seeded
+    int ready;
+    volatile sig_atomic_t busy; // in preload_serve
+    size_t pos; // PRELOAD_BUFFER when empty
+    u8 buf[PRELOAD_BUFFER];
+} st_preload_thread;
+
+static __thread st_preload_thread PRELOAD __attribute__((tls_model("initial-exec")));
+static _Atomic unsigned char PRELOAD_FD[PRELOAD_FDS];
+static pthread_key_t PRELOAD_KEY;
+static pthread_once_t PRELOAD_ONCE = PTHREAD_ONCE_INIT;
+
+static int (*real_open)(const char *, int, ...);
+static int (*real_open64)(const char *, int, ...);
+static int (*real_openat)(int, const char *, int, ...);
+static int (*real_openat64)(int, const char *, int, ...);
+static ssize_t (*real_read)(int, void *, size_t);
+static ssize_t (*real_read_chk)(int, void *, size_t, size_t);
+static int (*real_close)(int);
+static int (*real_fclose)(FILE *);
+static int (*real_dup2)(int, int);
+static int (*real_dup3)(int, int, int);
+static int (*real_close_range)(unsigned int, unsigned int, int);
+static void (*real_closefrom)(int);
+
+//! thread exit: nothing of the instance stays behind in the freed TLS block
+static void preload_exit(void *arg)
+{
+    (void)arg;
+    clear((u8 *)&PRELOAD, sizeof(st_preload_thread));
+}
+
+static void preload_resolve(void)
+{
+    real_open = dlsym(RTLD_NEXT, "open");
+    real_open64 = dlsym(RTLD_NEXT, "open64");
+    real_openat = dlsym(RTLD_NEXT, "openat");
+    real_openat64 = dlsym(RTLD_NEXT, "openat64");
+    real_read = dlsym(RTLD_NEXT, "read");
+    real_read_chk = dlsym(RTLD_NEXT, "__read_chk");
+    real_close = dlsym(RTLD_NEXT, "close");
+    real_fclose = dlsym(RTLD_NEXT, "fclose");
+    real_dup2 = dlsym(RTLD_NEXT, "dup2");
+    real_dup3 = dlsym(RTLD_NEXT, "dup3");
+    real_close_range = dlsym(RTLD_NEXT, "close_range");
+    real_closefrom = dlsym(RTLD_NEXT, "closefrom");
+    pthread_key_create(&PRELOAD_KEY, preload_exit);
+}
+
+//! another library's constructor may call in before ours has run
+#define PRELOAD_REAL(fn)                                  \
+    if (real_##fn == NULL)                                \
+        pthread_once(&PRELOAD_ONCE, preload_resolve);
+
+__attribute__((constructor)) static void preload_init(void)
+{
+    pthread_once(&PRELOAD_ONCE, preload_resolve);
+}
+
+//! this thread's instance, (re)seeded from the kernel as needed; FALSE if it cannot be
+static int preload_ready(unsigned int flags)
+{
+    st_preload_thread *t = &PRELOAD;
+    unsigned long gen = Fork_Generation();
+    u8 in[INSTANCE_INPUT];
+    size_t got = 0;
+
+    if (t->ready && t->fork_gen == gen)
+        return TRUE;
+    while (got < INSTANCE_INPUT)
+    {
+        long n = syscall(SYS_getrandom, in + got, INSTANCE_INPUT - got, flags & GRND_NONBLOCK);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            clear(in, INSTANCE_INPUT);
+            return FALSE;
+        }
+        got += (size_t)n;
+    }
+    //! a forked child drops the parent's buffered bytes with its instance
+    clear(t->buf, PRELOAD_BUFFER);
+    Instantiate(&t->state, in);
+    clear(in, INSTANCE_INPUT);
+    t->pos = PRELOAD_BUFFER;
+    t->fork_gen = gen;
+    if (!t->ready)
+        pthread_setspecific(PRELOAD_KEY, t);
+    t->ready = TRUE;
+    return TRUE;
+}
+
+//! len bytes into out, FALSE to leave the call to the kernel
+static int preload_serve(u8 *out, size_t len, unsigned int flags)
+{
+    st_preload_thread *t = &PRELOAD;
+    int saved = errno, ret = TRUE;
+
+    //! a signal handler interrupting this thread in here must not touch the instance
+    if (t->busy)
+        return FALSE;
+    t->busy = TRUE;
+    if (!preload_ready(flags))
+    {
+        ret = FALSE;
+    }
+    else if (len >= PRELOAD_BUFFER)
+    {
+        ret = generate_Bytes(&t->state, out, len, NULL);
+    }
+    else
+    {
+        while (len > 0)
+        {
+            size_t n;
+
+            if (t->pos == PRELOAD_BUFFER)
+            {
+                if (!generate_Bytes(&t->state, t->buf, PRELOAD_BUFFER, NULL))
+                {
+                    ret = FALSE;
+                    break;
+                }
+                t->pos = 0;
+            }
+            n = PRELOAD_BUFFER - t->pos < len ? PRELOAD_BUFFER - t->pos : len;
+            memcpy(out, t->buf + t->pos, n);
+            memset(t->buf + t->pos, 0, n);
+            t->pos += n;
+            out += n;
+            len -= n;
+        }
+    }
+    t->busy = FALSE;
+    errno = saved;
+    return ret;
+}
+
+//! fd is the urandom character device, checked once when it is opened
+static int preload_urandom(int fd)
+{
+    struct stat st;
+    int saved = errno, ret;
+
+    ret = fstat(fd, &st) == 0 && S_ISCHR(st.st_mode) && st.st_rdev == makedev(1, 9);
+    errno = saved;
+    return ret;
+}
+
+static void preload_track(int fd, const char *path)
+{
+    if (fd >= 0 && fd < PRELOAD_FDS)
+        atomic_store(&PRELOAD_FD[fd], path != NULL && strcmp(path, PRELOAD_URANDOM) == 0 && preload_urandom(fd));
+}
+
+static int preload_tracked(int fd)
+{
+    return fd >= 0 && fd < PRELOAD_FDS && atomic_load_explicit(&PRELOAD_FD[fd], memory_order_relaxed);
+}
+
+//! forget every fd from first to last
+static void preload_forget(unsigned int first, unsigned int last)
+{
+    for (unsigned int fd = first; fd <= last && fd < PRELOAD_FDS; fd++)
+        atomic_store(&PRELOAD_FD[fd], 0);
+}
+
+PRELOAD_EXPORT ssize_t getrandom(void *buf, size_t len, unsigned int flags)
+{
+    if (preload_serve((u8 *)buf, len, flags))
+        return (ssize_t)len;
+    return syscall(SYS_getrandom, buf, len, flags);
+}
+
+PRELOAD_EXPORT int getentropy(void *buf, size_t len)
+{
+    size_t got = 0;
+
+    if (len > 256)
+    {
+        errno = EIO;
+        return -1;
+    }
+    if (preload_serve((u8 *)buf, len, 0))
+        return 0;
+    while (got < len)
+    {
+        long n = syscall(SYS_getrandom, (u8 *)buf + got, len - got, 0);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        got += (size_t)n;
+    }
+    return 0;
+}
+
+//! mode is only there with O_CREAT or O_TMPFILE
+#define PRELOAD_MODE(flags, mode)                         \
+    if ((flags) & (O_CREAT | O_TMPFILE))                  \
+    {                                                     \
+        va_list ap;                                       \
+        va_start(ap, flags);                              \
+        mode = va_arg(ap, int);                           \
+        va_end(ap);                                       \
+    }
+
+PRELOAD_EXPORT int open(const char *path, int flags, ...)
+{
+    int mode = 0, fd;
+
+    PRELOAD_REAL(open);
+    PRELOAD_MODE(flags, mode);
+    fd = real_open(path, flags, mode);
+    preload_track(fd, path);
+    return fd;
+}
+
+PRELOAD_EXPORT int open64(const char *path, int flags, ...)
+{
+    int mode = 0, fd;
+
+    PRELOAD_REAL(open64);
+    PRELOAD_MODE(flags, mode);
+    fd = real_open64(path, flags, mode);
+    preload_track(fd, path);
+    return fd;
+}
+
+//! the path is matched as given, a relative one relative to dirfd is not taken
+PRELOAD_EXPORT int openat(int dirfd, const char *path, int flags, ...)
+{
+    int mode = 0, fd;
+
+    PRELOAD_REAL(openat);
+    PRELOAD_MODE(flags, mode);
+    fd = real_openat(dirfd, path, flags, mode);
+    preload_track(fd, path);
+    return fd;
+}
+
+PRELOAD_EXPORT int openat64(int dirfd, const char *path, int flags, ...)
+{
+    int mode = 0, fd;
+
+    PRELOAD_REAL(openat64);
+    PRELOAD_MODE(flags, mode);
+    fd = real_openat64(dirfd, path, flags, mode);
+    preload_track(fd, path);
+    return fd;
+}
+
+PRELOAD_EXPORT ssize_t read(int fd, void *buf, size_t len)
+{
+    if (preload_tracked(fd) && preload_serve((u8 *)buf, len, 0))
+        return (ssize_t)len;
+    PRELOAD_REAL(read);
+    return real_read(fd, buf, len);
+}
+
+PRELOAD_EXPORT ssize_t __read_chk(int fd, void *buf, size_t len, size_t buflen)
+{
+    if (len <= buflen && preload_tracked(fd) && preload_serve((u8 *)buf, len, 0))
+        return (ssize_t)len;
+    PRELOAD_REAL(read_chk);
+    return real_read_chk(fd, buf, len, buflen);
+}
+
+PRELOAD_EXPORT int close(int fd)
+{
+    PRELOAD_REAL(close);
+    preload_track(fd, NULL);
+    return real_close(fd);
+}
+
+PRELOAD_EXPORT int fclose(FILE *stream)
+{
+    PRELOAD_REAL(fclose);
+    preload_track(fileno(stream), NULL);
+    return real_fclose(stream);
+}
+
+PRELOAD_EXPORT int dup2(int oldfd, int newfd)
+{
+    int fd;
+
+    PRELOAD_REAL(dup2);
+    fd = real_dup2(oldfd, newfd);
+
+    if (fd >= 0 && fd < PRELOAD_FDS)
+        atomic_store(&PRELOAD_FD[fd], preload_tracked(oldfd));
+    return fd;
+}
+
+PRELOAD_EXPORT int dup3(int oldfd, int newfd, int flags)
+{
+    int fd;
+
+    PRELOAD_REAL(dup3);
+    fd = real_dup3(oldfd, newfd, flags);
+
+    if (fd >= 0 && fd < PRELOAD_FDS)
+        atomic_store(&PRELOAD_FD[fd], preload_tracked(oldfd));
+    return fd;
+}
+
+PRELOAD_EXPORT int close_range(unsigned int first, unsigned int last, int flags)
+{
+    PRELOAD_REAL(close_range);
+    //! CLOSE_RANGE_CLOEXEC only marks the fds, they stay open until an exec
+    if (!(flags & CLOSE_RANGE_CLOEXEC))
+        preload_forget(first, last);
+    if (real_close_range != NULL)
+        return real_close_range(first, last, flags);
+    return (int)syscall(SYS_close_range, first, last, flags);
+}
+
+PRELOAD_EXPORT void closefrom(int lowfd)
+{
+    PRELOAD_REAL(closefrom);
+    if (lowfd >= 0)
+        preload_forget((unsigned int)lowfd, PRELOAD_FDS - 1);
+    if (real_closefrom != NULL)
+        real_closefrom(lowfd);
+    else if (lowfd >= 0)
+        syscall(SYS_close_range, (unsigned int)lowfd, ~0U, 0);
+}
@@ -0,0 +1,303 @@
+#include "../header.h"
+#include <pthread.h>
+#include <openssl/core.h>
+#include <openssl/core_dispatch.h>
+#include <openssl/core_names.h>
+#include <openssl/evp.h>
+#include <openssl/params.h>
+
+/*
+*   ctrdrbg-provider : this CTR_DRBG as an OpenSSL 3 EVP_RAND
+*
+*   Make it the DRBG of every program in openssl.cnf, next to the default
+*   provider (which the seed source and ciphers still come from):
+*
+*       openssl_conf = init
+*       [init]
+*       providers = providers
+*       random = random
+*       [providers]
+*       default = default
+*       ctrdrbg = ctrdrbg
+*       [default]
+*       activate = 1
+*       [ctrdrbg]
+*       module = /path/to/ctrdrbg-provider.so
+*       activate = 1
+*       [random]
+*       random = CTR-DRBG-ARIA
+*       properties = provider=ctrdrbg
+*
+*   or in a program, before its first RAND_bytes, after loading the module
+*   with OSSL_PROVIDER_load: RAND_set_DRBG_type(NULL, "CTR-DRBG-ARIA",
+*   "provider=ctrdrbg", NULL, NULL). EVP_RAND_fetch gives an instance of
+*   its own, with instantiate, reseed and generate taking additional input.
+*
+*   Generate runs generate_Bytes, so output uses the bound kernel and
+*   follows the library's reseed policy. Entropy comes from the library's
+*   default source, not from an OpenSSL parent. Personalization and
+*   additional input of any length go through Block_Cipher_df (SP 800-90A
+*   10.3.2) to SEED_LEN bytes and are mixed in with update_first_call,
+*   as SP 800-90A does for additional input; a reseed runs the df over
+*   entropy || additional input (Reseed_Input).
+*
+*   build (in ICISC) : make ctrdrbg-provider.so
+*/
+#define PROVIDER_NAME "ctrdrbg"
+#define PROVIDER_RAND_NAME "CTR-DRBG-ARIA"
+#define PROVIDER_MAX_REQUEST (1 << 20) // generate_Bytes splits it into MAX_REQUEST_LEN requests
+#define PROVIDER_EXPORT __attribute__((visibility("default")))
+
+typedef struct _PROVIDER_DRBG {
+    st_state state;
+    int status; // EVP_RAND_STATE_*
+    pthread_mutex_t *lock;
+} st_provider_drbg;
+
+//! (Key, V) = Update(df(data), Key, V); nothing to do for no data
+static int provider_absorb(st_state *state, const unsigned char *data, size_t len)
+{
+    u8 seed[SEED_LEN];
+
+    if (data == NULL || len == 0)
+        return TRUE;
+    if (!Block_Cipher_df(data, len, NULL, 0, seed))
+        return FALSE;
+    update_first_call(state, seed);
+    clear(seed, SEED_LEN);
+    return TRUE;
+}
+
+static void *drbg_new(void *provctx, void *parent, const OSSL_DISPATCH *parent_calls)
+{
+    (void)provctx;
+    (void)parent;
+    (void)parent_calls;
+    return Secure_Alloc(sizeof(st_provider_drbg), 0);
+}
+
+static void drbg_free(void *vctx)
+{
+    st_provider_drbg *ctx = (st_provider_drbg *)vctx;
+
+    if (ctx == NULL)
+        return;
+    if (ctx->lock != NULL)
+    {
+        pthread_mutex_destroy(ctx->lock);
+        free(ctx->lock);
+    }
+    Secure_Free(ctx);
+}
+
+static int drbg_instantiate(void *vctx, unsigned int strength, int prediction_resistance,
+                            const unsigned char *pstr, size_t pstr_len, const OSSL_PARAM params[])
+{
+    st_provider_drbg *ctx = (st_provider_drbg *)vctx;
+    u8 in[INSTANCE_INPUT] = {0x00};
+
+    (void)prediction_resistance;
+    (void)params;
+    if (strength > KEY_BIT || !Entropy_Read(NULL, in, ENTROPHY_LEN + NONCE))
+    {
+        ctx->status = EVP_RAND_STATE_ERROR;
+        return 0;
+    }
+    //! the fixed personalization field stays zero, pstr is absorbed whole
+    Instantiate(&ctx->state, in);
+    clear(in, INSTANCE_INPUT);
+    if (!provider_absorb(&ctx->state, pstr, pstr_len))
+    {
+        clear((u8 *)&ctx->state, sizeof(st_state));
+        ctx->status = EVP_RAND_STATE_ERROR;
+        return 0;
+    }
+    ctx->status = EVP_RAND_STATE_READY;
+    return 1;
+}
+
+static int drbg_uninstantiate(void *vctx)
+{
+    st_provider_drbg *ctx = (st_provider_drbg *)vctx;
+
+    clear((u8 *)&ctx->state, sizeof(st_state));
+    ctx->status = EVP_RAND_STATE_UNINITIALISED;
+    return 1;
+}
+
+static int drbg_generate(void *vctx, unsigned char *out, size_t outlen, unsigned int strength,
+                         int prediction_resistance, const unsigned char *adin, size_t adin_len)
+{
+    st_provider_drbg *ctx = (st_provider_drbg *)vctx;
+
+    if (ctx->status != EVP_RAND_STATE_READY || strength > KEY_BIT)
+        return 0;
+    if ((prediction_resistance && !Reseed_Prediction(&ctx->state, NULL)) ||
+        !provider_absorb(&ctx->state, adin, adin_len) ||
+        !generate_Bytes(&ctx->state, out, outlen, NULL))
+    {
+        //! no entropy for a due reseed, nothing more until reinstantiated
+        clear(out, (int)outlen);
+        ctx->status = EVP_RAND_STATE_ERROR;
+        return 0;
+    }
+    return 1;
+}
+
+static int drbg_reseed(void *vctx, int prediction_resistance, const unsigned char *ent, size_t ent_len,
+                       const unsigned char *adin, size_t adin_len)
+{
+    st_provider_drbg *ctx = (st_provider_drbg *)vctx;
+    u8 in[RESEED_ENTROPY_LEN];
+    int ret;
+
+    (void)prediction_resistance;
+    if (ctx->status != EVP_RAND_STATE_READY)
+        return 0;
+    if (ent != NULL && ent_len != 0)
+        return Reseed_Input(&ctx->state, ent, ent_len, adin, adin_len);
+    if (!Entropy_Read(NULL, in, RESEED_ENTROPY_LEN))
+        return 0;
+    ret = Reseed_Input(&ctx->state, in, RESEED_ENTROPY_LEN, adin, adin_len);
+    clear(in, RESEED_ENTROPY_LEN);
+    return ret;
+}
+
+static int drbg_enable_locking(void *vctx)
+{
+    st_provider_drbg *ctx = (st_provider_drbg *)vctx;
+
+    if (ctx->lock != NULL)
+        return 1;
+    ctx->lock = (pthread_mutex_t *)malloc(sizeof(pthread_mutex_t));
+    if (ctx->lock == NULL)
+        return 0;
+    pthread_mutex_init(ctx->lock, NULL);
+    return 1;
+}
+
+static int drbg_lock(void *vctx)
+{
+    st_provider_drbg *ctx = (st_provider_drbg *)vctx;
+
+    return ctx->lock == NULL || pthread_mutex_lock(ctx->lock) == 0;
+}
+
+static void drbg_unlock(void *vctx)
+{
+    st_provider_drbg *ctx = (st_provider_drbg *)vctx;
+
+    if (ctx->lock != NULL)
+        pthread_mutex_unlock(ctx->lock);
+}
+
+static const OSSL_PARAM *drbg_gettable_ctx_params(void *vctx, void *provctx)
+{
+    static const OSSL_PARAM PARAMS[] = {
+        OSSL_PARAM_int(OSSL_RAND_PARAM_STATE, NULL),
+        OSSL_PARAM_uint(OSSL_RAND_PARAM_STRENGTH, NULL),
+        OSSL_PARAM_size_t(OSSL_RAND_PARAM_MAX_REQUEST, NULL),
+        OSSL_PARAM_END};
+
+    (void)vctx;
+    (void)provctx;
+    return PARAMS;
+}
+
+static int drbg_get_ctx_params(void *vctx, OSSL_PARAM params[])
+{
+    st_provider_drbg *ctx = (st_provider_drbg *)vctx;
+    OSSL_PARAM *p;
+
+    if ((p = OSSL_PARAM_locate(params, OSSL_RAND_PARAM_STATE)) != NULL && !OSSL_PARAM_set_int(p, ctx->status))
+        return 0;
+    if ((p = OSSL_PARAM_locate(params, OSSL_RAND_PARAM_STRENGTH)) != NULL && !OSSL_PARAM_set_uint(p, KEY_BIT))
+        return 0;
+    if ((p = OSSL_PARAM_locate(params, OSSL_RAND_PARAM_MAX_REQUEST)) != NULL && !OSSL_PARAM_set_size_t(p, PROVIDER_MAX_REQUEST))
+        return 0;
+    return 1;
+}
+
+static int drbg_verify_zeroization(void *vctx)
+{
+    st_provider_drbg *ctx = (st_provider_drbg *)vctx;
+    const u8 *p = (const u8 *)&ctx->state;
+    u8 acc = 0;
+
+    for (size_t cnt_i = 0; cnt_i < sizeof(st_state); cnt_i++)
+        acc |= p[cnt_i];
+    return acc == 0;
+}
+
+static const OSSL_DISPATCH DRBG_FUNCTIONS[] = {
+    {OSSL_FUNC_RAND_NEWCTX, (void (*)(void))drbg_new},
+    {OSSL_FUNC_RAND_FREECTX, (void (*)(void))drbg_free},
+    {OSSL_FUNC_RAND_INSTANTIATE, (void (*)(void))drbg_instantiate},
+    {OSSL_FUNC_RAND_UNINSTANTIATE, (void (*)(void))drbg_uninstantiate},
+    {OSSL_FUNC_RAND_GENERATE, (void (*)(void))drbg_generate},
+    {OSSL_FUNC_RAND_RESEED, (void (*)(void))drbg_reseed},
+    {OSSL_FUNC_RAND_ENABLE_LOCKING, (void (*)(void))drbg_enable_locking},
+    {OSSL_FUNC_RAND_LOCK, (void (*)(void))drbg_lock},
+    {OSSL_FUNC_RAND_UNLOCK, (void (*)(void))drbg_unlock},
+    {OSSL_FUNC_RAND_GETTABLE_CTX_PARAMS, (void (*)(void))drbg_gettable_ctx_params},
+    {OSSL_FUNC_RAND_GET_CTX_PARAMS, (void (*)(void))drbg_get_ctx_params},
+    {OSSL_FUNC_RAND_VERIFY_ZEROIZATION, (void (*)(void))drbg_verify_zeroization},
+    {0, NULL}};
+
+static const OSSL_ALGORITHM PROVIDER_RANDS[] = {
+    {PROVIDER_RAND_NAME, "provider=" PROVIDER_NAME, DRBG_FUNCTIONS, "CTR_DRBG on the KCMVP block cipher"},
+    {NULL, NULL, NULL, NULL}};
+
+static const OSSL_ALGORITHM *provider_query(void *provctx, int operation_id, int *no_cache)
+{
+    (void)provctx;
+    *no_cache = 0;
+    return operation_id == OSSL_OP_RAND ? PROVIDER_RANDS : NULL;
+}
+
+static const OSSL_PARAM *provider_gettable_params(void *provctx)
+{
+    static const OSSL_PARAM PARAMS[] = {
+        OSSL_PARAM_utf8_ptr(OSSL_PROV_PARAM_NAME, NULL, 0),
+        OSSL_PARAM_utf8_ptr(OSSL_PROV_PARAM_BUILDINFO, NULL, 0),
+        OSSL_PARAM_int(OSSL_PROV_PARAM_STATUS, NULL),
+        OSSL_PARAM_END};
+
+    (void)provctx;
+    return PARAMS;
+}
+
+static int provider_get_params(void *provctx, OSSL_PARAM params[])
+{
+    OSSL_PARAM *p;
+
+    (void)provctx;
+    if ((p = OSSL_PARAM_locate(params, OSSL_PROV_PARAM_NAME)) != NULL && !OSSL_PARAM_set_utf8_ptr(p, PROVIDER_NAME))
+        return 0;
+    if ((p = OSSL_PARAM_locate(params, OSSL_PROV_PARAM_BUILDINFO)) != NULL && !OSSL_PARAM_set_utf8_ptr(p, Kernel()->name))
+        return 0;
+    if ((p = OSSL_PARAM_locate(params, OSSL_PROV_PARAM_STATUS)) != NULL && !OSSL_PARAM_set_int(p, 1))
+        return 0;
+    return 1;
+}
+
+static void provider_teardown(void *provctx)
+{
+    (void)provctx;
+}
+
+static const OSSL_DISPATCH PROVIDER_FUNCTIONS[] = {
+    {OSSL_FUNC_PROVIDER_QUERY_OPERATION, (void (*)(void))provider_query},
+    {OSSL_FUNC_PROVIDER_GETTABLE_PARAMS, (void (*)(void))provider_gettable_params},
+    {OSSL_FUNC_PROVIDER_GET_PARAMS, (void (*)(void))provider_get_params},
+    {OSSL_FUNC_PROVIDER_TEARDOWN, (void (*)(void))provider_teardown},
+    {0, NULL}};
+
+PROVIDER_EXPORT int OSSL_provider_init(const OSSL_CORE_HANDLE *handle, const OSSL_DISPATCH *in,
+                                       const OSSL_DISPATCH **out, void **provctx)
+{
+    (void)in;
+    *out = PROVIDER_FUNCTIONS;
+    *provctx = (void *)handle;
+    return 1;
+}